@@ -15,18 +15,81 @@ object DmaOpcode {
   val WRITE_SYNC = 3
   val SET = 4
   val COPY = 5
+  // Updates CRC32 (APB register 40) with bytes [b_from, b_to) of the buffer; b_from and b_to are multiples of 8.
+  val CRC32 = 6
 
   val LOADMAP = 7
   val MAP1R2 = 8
   val MAP1R4 = 9
 
+  // 1bpp to RGB565 expansion (glyphs, monochrome bitmaps). Output pixel j at b_from + 2*j (b_from is 8-byte aligned)
+  // is EXPAND_SETUP foreground if bit j of the source at byte d32(12 downto 0) is set, and background otherwise.
+  // Bits are taken from the lowest of every byte, or from the highest if d32(13) is set.
+  // EXPAND_TRANSPARENT - pixels with clear bits are not written.
+  val EXPAND = 10
+  val EXPAND_TRANSPARENT = 11
+
+  // Transposes tiles of 32x32 16-bit pixels: line L of the result is column L of the source. Tiles are 32 lines of
+  // 64 bytes (as read by RECT_READ with 64-byte lines) one after another; the source is at d32(12 downto 0),
+  // the result at [b_from, b_to). Both are 64-byte aligned, b_to - b_from is a multiple of 2048.
+  // 90-degree rotations are TRANSPOSE with a negative source (clockwise) or destination (counterclockwise) stride.
+  val TRANSPOSE = 12
+
+  // Rectangle memory operations. Buffer range [b_from, b_to) holds lines of RECT_SETUP line size packed one after another,
+  // memory address advances by source (for reads) or destination (for writes) stride after every line.
+  val RECT_READ = 16
+  val RECT_WRITE = 17
+  val RECT_READ_SYNC = 18
+  val RECT_WRITE_SYNC = 19
+  // b_to - line size in bytes (multiple of 64), d32 - destination stride (bits 31..16) and source stride (bits 15..0),
+  // both signed, in 64-byte units.
+  val RECT_SETUP = 20
+
+  // Control flow. Command addresses are 8-byte aligned byte addresses in d32 (bits 29..3).
+  // JUMP - continue from address d32 with command count instr(47..32); count 0 ends the program.
+  // LOOP - execute commands up to the matching ENDLOOP instr(47..32) times (at least once). Loops can't be nested.
+  //        d32 - write (bits 31..16) and read (bits 15..0) address increments, signed, in 64-byte units.
+  //        After every iteration the increments are added to the addresses of all memory operations in the loop body.
+  val JUMP = 21
+  val LOOP = 22
+  val ENDLOOP = 23
+
+  // d32(16 downto 0) - RESAMPLE step in source pixels, 16 fractional bits, 1..0x10000 (scale factor 1 or more).
+  val RESAMPLE_SETUP = 24
+  // d32 - EXPAND background (bits 31..16) and foreground (bits 15..0) colors.
+  val EXPAND_SETUP = 25
+
   val MIXRGB = 32
+
+  // RGB565 alpha blending of the source (b_arg) over the second argument (b_arg2, word aligned).
+  // Every channel: res = (src * alpha + arg2 * (64 - alpha) + 32) >> 6, alpha = d32(31 downto 26), i.e. 0..63.
+  // BLEND_RGAB - the source is RGAB5515 (as VIDEO_RGAB5515 in the video controller): pixels with A=1 are opaque
+  //              (alpha 64), pixels with A=0 are blended with alpha from d32. 5-bit G is expanded to G5 ## G5[4].
+  val BLEND = 34
+  val BLEND_RGAB = 35
+
+  // Horizontal RGB565 resampling. Output pixel j at buffer address b_from + 2*j (b_from is 8-byte aligned) samples
+  // source position P = d32(12 downto 1) + d32(31 downto 16)/65536 + j * step (in pixels of the source at d32(12 downto 0)).
+  // RESAMPLE        - nearest: src[P >> 16]
+  // RESAMPLE_LINEAR - src[P >> 16] and src[(P >> 16) + 1] blended as in BLEND with alpha = P(15 downto 10)
+  // Palette-mapped lines are resampled after MAP1R2.
+  val RESAMPLE = 36
+  val RESAMPLE_LINEAR = 37
+
+  // YUV 4:2:0 line to RGB565, BT.601 limited range. Output pixel j at b_from + 2*j (b_from is 8-byte aligned)
+  // is converted from Y[j], U[j/2], V[j/2]; Y at d32(12 downto 0) (4-byte aligned), U at d32(25 downto 13)
+  // (2-byte aligned), V at U + d32(31 downto 26) * 64. With C = Y - 16, D = U - 128, E = V - 128:
+  //   R = clamp((298 * C + 409 * E + 128) >> 8)
+  //   G = clamp((298 * C - 100 * D - 208 * E + 128) >> 8)
+  //   B = clamp((298 * C + 516 * D + 128) >> 8)
+  // and the result is R(7 downto 3) ## G(7 downto 2) ## B(7 downto 3).
+  val YUV420 = 38
 }
 
 class DmaController extends Component {
   val io = new Bundle {
     val apb = slave(Apb3(Apb3Config(
-      addressWidth  = 4,
+      addressWidth  = 6,
       dataWidth     = 32,
       useSlaveError = false
     )))
@@ -77,8 +140,8 @@ class DmaController extends Component {
   val buffer = Mem(Bits(64 bits), wordCount = 1024)
 
   val argAddrS = Stream(UInt(10 bits))
-  val argDataS = Flow(Bits(128 bits))
-  val arg2Buf = Reg(Bits(64 bits))
+  val argDataS = Flow(Bits(192 bits))
+  val arg2Buf, arg3Buf = Reg(Bits(64 bits))
   val writeResS = Flow(new Bundle {
     val addr = UInt(10 bits)
     val data = Bits(64 bits)
@@ -87,24 +150,60 @@ class DmaController extends Component {
   val fetchAddr = UInt(10 bits)
   val fetchS = Stream(Bits(64 bits))
 
-  val arg1Addr, arg2Addr, resAddr = Reg(UInt(10 bits))
-  val arg1RepeatCounter = Reg(UInt(2 bits))
-  val arg1Step = Reg(UInt(3 bits))
-  val arg2Turn = Reg(Bool())
-  val has_arg2 = Bool()
+  // Every pipeline item reads arg3 (if has_arg3), arg2 (if has_arg2) and arg1 in this order.
+  // Steps are in quarters of 64-bit word; arg3 uses the step of arg2.
+  val arg1Addr, arg2Addr, arg3Addr, resAddr = Reg(UInt(10 bits))
+  val arg1RepeatCounter, arg2RepeatCounter, arg3RepeatCounter = Reg(UInt(2 bits))
+  val arg1Step, arg2Step = Reg(UInt(3 bits))
+  val arg2Turn, arg3Turn = Reg(Bool())
+  val has_arg2, has_arg3 = Bool()
+  val resampling = Bool()
+  val expanding = Bool()
+  val expand_nibble = Reg(UInt(2 bits))  // EXPAND takes 4 source bits per output word
+  val expand_fg, expand_bg = Reg(Bits(16 bits))
+  val transposing = Bool()
+  val transpose_read, transpose_write = Reg(UInt(10 bits))  // item numbers of the next argument read and result write
+  val transpose_arg_base, transpose_res_base = Reg(UInt(10 bits))
+  // Item n = tile ## c ## q ## i (3, 3 and 2 bits) reads source line 4q+i, word c and writes result line 4c+i, word q.
+  def transposeReadOrder(n: UInt) : UInt = (n(9 downto 8) ## n(4 downto 2) ## n(1 downto 0) ## n(7 downto 5)).asUInt
+  def transposeWriteOrder(n: UInt) : UInt = (n(9 downto 8) ## n(7 downto 5) ## n(1 downto 0) ## n(4 downto 2)).asUInt
+  val resample_step = Reg(UInt(17 bits))
+  val resample_pos = Reg(UInt(28 bits))  // source position of the next output word, in pixels with 16 fractional bits
   when (argAddrS.fire) {
-    when (arg2Turn) {
-      arg2Addr := arg2Addr + 1
+    when (arg3Turn) {
+      val next = (arg3Addr ## arg3RepeatCounter).asUInt + arg2Step
+      arg3Addr := next(11 downto 2)
+      arg3RepeatCounter := next(1 downto 0)
+      arg3Turn := False
+    } elsewhen (arg2Turn) {
+      val next = (arg2Addr ## arg2RepeatCounter).asUInt + arg2Step
+      arg2Addr := next(11 downto 2)
+      arg2RepeatCounter := next(1 downto 0)
       arg2Turn := False
+    } elsewhen (transposing) {
+      transpose_read := transpose_read + 1
+      arg1Addr := transpose_arg_base + transposeReadOrder(transpose_read + 1)
+    } elsewhen (resampling) {
+      // every output word reads source words containing pixels [P & ~3, (P & ~3) + 8)
+      val next = resample_pos + (resample_step << 2)
+      resample_pos := next
+      arg1Addr := next(27 downto 18)
+      arg2Addr := next(27 downto 18) + 1
+      arg2Turn := True
     } otherwise {
-      val next = (arg1Addr ## arg1RepeatCounter).asUInt + arg1Step
+      val next = (arg1Addr ## arg1RepeatCounter).asUInt + Mux(expanding & ~expand_nibble.andR, U(0, 3 bits), arg1Step)
+      expand_nibble := expand_nibble + 1
       arg1Addr := next(11 downto 2)
       arg1RepeatCounter := next(1 downto 0)
       arg2Turn := has_arg2
+      arg3Turn := has_arg3
     }
   }
-  when (writeResS.fire) { resAddr := resAddr + 1 }
-  argAddrS.payload := Mux(arg2Turn, arg2Addr, arg1Addr)
+  when (writeResS.fire) {
+    transpose_write := transpose_write + 1
+    resAddr := Mux(transposing, transpose_res_base + transposeWriteOrder(transpose_write + 1), resAddr + 1)
+  }
+  argAddrS.payload := Mux(arg3Turn, arg3Addr, Mux(arg2Turn, arg2Addr, arg1Addr))
   writeResS.payload.addr := resAddr
 
   val bufPort1 = new Area {
@@ -115,10 +214,13 @@ class DmaController extends Component {
     val mask = RegNext(writeResS.payload.mask)
     val rdata = buffer.readWriteSync(addr, wdata, en, writeEn, mask)
     val rdataFire = RegNext(RegNext(argAddrS.fire))
-    val rdataArg2 = RegNext(RegNext(arg2Turn))
+    val rdataArg2 = RegNext(RegNext(arg2Turn | arg3Turn))
     argAddrS.ready := ~writeResS.valid
-    when (rdataFire) { arg2Buf := rdata }
-    argDataS.payload := arg2Buf ## rdata
+    when (rdataFire) {
+      arg2Buf := rdata
+      arg3Buf := arg2Buf
+    }
+    argDataS.payload := arg3Buf ## arg2Buf ## rdata
     argDataS.valid := rdataFire & ~rdataArg2
     fetchS.valid := RegNext(RegNext(~writeResS.valid & ~argAddrS.valid & fetchS.ready))
     fetchS.payload := rdata
@@ -173,6 +275,42 @@ class DmaController extends Component {
   val mem_write = Reg(Bool())
   val mem_buf_addr = Reg(Vec.fill(4)(UInt(7 bits)))
 
+  // Buffer hazard tracking: 64-byte buffer blocks with a Get in flight. Commands that read or overwrite such blocks
+  // wait for the data, so asynchronous READ and WRITE need no _SYNC to protect the buffer.
+  // Blocks of the current memory operation that have no request yet are covered by buf_unissued.
+  val buf_pending = RegInit(B(0, 128 bits))
+  val buf_pending_set = False
+  buf_pending := (buf_pending & ~Mux(d_last & tl_d_AccessAckData, UIntToOh(mem_buf_addr(io.tl_bus.d.payload.source), 128), B(0, 128 bits))) |
+                 Mux(buf_pending_set, UIntToOh(mem_buf_base, 128), B(0, 128 bits))
+
+  // Blocks [from, to), wraps around if to <= from.
+  def blockRange(from: UInt, to: UInt) : Bits = {
+    val lo = B(128 bits, default -> True) |<< from
+    val hi = ~(B(128 bits, default -> True) |<< to)
+    Mux(to > from, lo & hi, lo | hi)
+  }
+  val buf_unissued = Mux(mem_counter =/= 0, blockRange(mem_buf_base, mem_buf_base + mem_counter), B(0, 128 bits))
+
+  val rect_line_blocks = Reg(UInt(7 bits))
+  val rect_src_stride = Reg(UInt(24 bits))
+  val rect_dst_stride = Reg(UInt(24 bits))
+  val mem_rect = Reg(Bool())
+  val mem_stride = Reg(UInt(24 bits))
+  val mem_line_addr = Reg(UInt(24 bits))
+  val mem_line_blocks = Reg(UInt(7 bits))
+  val mem_line_counter = Reg(UInt(7 bits))
+
+  def nextMemBlock() : Unit = {
+    when (mem_rect & mem_line_counter === 1) {
+      mem_addr := mem_line_addr + mem_stride
+      mem_line_addr := mem_line_addr + mem_stride
+      mem_line_counter := mem_line_blocks
+    } otherwise {
+      mem_addr := mem_addr + 1
+      mem_line_counter := mem_line_counter - 1
+    }
+  }
+
   val tl_a_source = Reg(UInt(2 bits))
   io.tl_bus.a.payload.source := tl_a_source
   io.tl_bus.a.payload.opcode := Mux(mem_write, tilelink.Opcode.A.PUT_FULL_DATA, tilelink.Opcode.A.GET)
@@ -208,7 +346,8 @@ class DmaController extends Component {
         tl_id_busy(tl_a_source) := True
         mem_buf_addr(tl_a_source) := mem_buf_base
         when (io.tl_bus.a.fire) {
-          mem_addr := mem_addr + 1
+          buf_pending_set := True
+          nextMemBlock()
           mem_buf_base := mem_buf_base + 1
           mem_counter := mem_counter - 1
           goto(Idle)
@@ -222,7 +361,7 @@ class DmaController extends Component {
         tl_id_busy(tl_a_source) := True
         when (io.tl_bus.a.fire) {
           when (a_beat_counter === 7) {
-            mem_addr := mem_addr + 1
+            nextMemBlock()
             mem_counter := mem_counter - 1
             when (mem_counter === 1 || tl_id_busy.andR) {
               goto(Idle)
@@ -245,7 +384,9 @@ class DmaController extends Component {
     val b_arg = instr(12 downto 0).asUInt - b_from(2 downto 0)
     val b_arg2 = instr(25 downto 13).asUInt
     has_arg2 := opcode(5)
+    has_arg3 := opcode === DmaOpcode.YUV420
     val d32 = instr(31 downto 0)
+    val resample_start = (b_arg(12 downto 1) ## instr(31 downto 16)).asUInt
 
     val shift = Reg(UInt(3 bits))
     val shift_mask = Reg(Bits(8 bits))
@@ -253,15 +394,43 @@ class DmaController extends Component {
     val wmask_last = Reg(Bits(8 bits))
     val cmdSet = Reg(Bool())
     val cmdMixrgb = Reg(Bool())
+    val cmdBlend = Reg(Bool())
+    val cmdBlendRgab = Reg(Bool())
+    val cmdResample = Reg(Bool())
+    val cmdResampleLinear = Reg(Bool())
+    val cmdYuv = Reg(Bool())
+    val cmdCrc = Reg(Bool())
+    val cmdExpand = Reg(Bool())
+    val cmdExpandTransparent = Reg(Bool())
+    val expandMsbFirst = Reg(Bool())
+    val cmdTranspose = Reg(Bool())
+    val alpha = Reg(UInt(7 bits))
     val cmdLoadMap = Reg(Bool())
     val cmdMap = Reg(Bool())
     val cmdMap2 = Reg(Bool())
+    val cmdFetch = Reg(Bool())  // current READ is generated by the command FSM to fetch instructions
+  }
+
+  // *** CRC32 (polynomial 0xEDB88320, bytes are processed from the lowest)
+
+  val crc_state = RegInit(B(0xffffffffL, 32 bits))  // inverted CRC
+
+  def crc32Update(crc: Bits, data: Bits) : Bits = {
+    var c = crc
+    for (i <- 0 until data.getWidth) {
+      val b = c(0) ^ data(i)
+      c = (c >> 1).resize(32 bits) ^ Mux(b, B(0xedb88320L, 32 bits), B(0, 32 bits))
+    }
+    c
   }
 
   // *** Pipeline
 
   val runPipeline = False
   argAddrS.valid := runPipeline
+  resampling := I.cmdResample
+  expanding := I.cmdExpand
+  transposing := I.cmdTranspose
   val work_counter = Reg(UInt(10 bits))
   val first = Reg(Bool())
 
@@ -272,12 +441,26 @@ class DmaController extends Component {
 
   val RAW_SARG = N0.insert(Mux(I.cmdSet, I.d32 #* 2, argDataS.payload(63 downto 0)))
   val FARG = N0.insert(argDataS.payload(127 downto 64))
+  val TARG = N0.insert(argDataS.payload(191 downto 128))
 
   val FIRST = Payload(Bool())
   val LAST = Payload(Bool())
   val DUMMY = Payload(Bool())
   val SARG = Payload(Bits(64 bits))
   val SHIFTED = Payload(Bits(64 bits))
+  val RS_POS = Payload(UInt(18 bits))  // position of the first output pixel relative to the first source word
+  val RS_A = Payload(Bits(64 bits))    // RESAMPLE: src[P >> 16] for every output pixel
+  val RS_B = Payload(Bits(64 bits))    // RESAMPLE: src[(P >> 16) + 1]
+  val RS_W = Payload(Bits(24 bits))    // RESAMPLE: weights of RS_B, 6 bits per pixel
+  val YUV_INDEX = Payload(UInt(2 bits))               // number of the output word, modulo 4
+  val YUV_L = Payload(Vec.fill(4)(SInt(20 bits)))     // 298 * C for every output pixel
+  val YUV_R = Payload(Vec.fill(2)(SInt(20 bits)))     // 409 * E for every pair of output pixels
+  val YUV_G = Payload(Vec.fill(2)(SInt(20 bits)))     // -100 * D - 208 * E
+  val YUV_B = Payload(Vec.fill(2)(SInt(20 bits)))     // 516 * D
+  val EXP_INDEX = Payload(UInt(4 bits))  // EXPAND: position of the source bits in the argument word, in nibbles
+  val EXP_BITS = Payload(Bits(4 bits))   // EXPAND: source bits of the output pixels
+  val TR_ROW = Payload(UInt(2 bits))     // TRANSPOSE: i in the item number
+  val TR_SKIP = Payload(Bool())          // TRANSPOSE: the first 4 items only fill the block register
 
   val Ns = new pip.Ctrl(1) {
     SHIFTED := RAW_SARG.rotateRight(I.shift<<3)
@@ -291,10 +474,46 @@ class DmaController extends Component {
     mapAddrS.addr1 := RegNextWhen((I.b_arg2(11 downto 10) ## mapIndices(7 downto 0)).asUInt, isValid)
     mapAddrS.addr2 := RegNextWhen((I.b_arg2(11 downto 10) ## mapIndices(15 downto 8)).asUInt, isValid)
     mapAddrS.valid := I.cmdMap
+
+    val resamplePos = Reg(UInt(18 bits))
+    when (~runPipeline) {
+      resamplePos := I.resample_start(17 downto 0)
+    } elsewhen (isValid) {
+      resamplePos := (resamplePos + (resample_step << 2)).resized
+    }
+    RS_POS := resamplePos
+
+    val yuvIndex = Reg(UInt(2 bits))
+    when (~runPipeline) {
+      yuvIndex := 0
+    } elsewhen (isValid) {
+      yuvIndex := yuvIndex + 1
+    }
+    YUV_INDEX := yuvIndex
+
+    val expandIndex = Reg(UInt(4 bits))
+    when (~runPipeline) {
+      expandIndex := (I.b_arg(2 downto 0) ## B"0").asUInt
+    } elsewhen (isValid) {
+      expandIndex := expandIndex + 1
+    }
+    EXP_INDEX := expandIndex
+
+    val transposeRow = Reg(UInt(2 bits))
+    val transposeStarted = Reg(Bool())
+    when (~runPipeline) {
+      transposeRow := 0
+      transposeStarted := False
+    } elsewhen (isValid) {
+      transposeRow := transposeRow + 1
+      when (transposeRow === 3) { transposeStarted := True }
+    }
+    TR_ROW := transposeRow
+    TR_SKIP := ~transposeStarted
   }
 
   val Nbuf = new pip.Ctrl(2) {
-    haltWhen(~Ns.up.isValid & ~I.cmdMap)
+    haltWhen(~Ns.up.isValid & ~I.cmdMap & ~I.cmdResample & ~I.cmdYuv & ~I.cmdExpand & ~I.cmdTranspose)
     throwWhen(~runPipeline)
   }
 
@@ -321,6 +540,47 @@ class DmaController extends Component {
     for (i <- 0 to 7) {
       SARG(i*8 + 7 downto i*8) := Mux(I.shift_mask(i), SHIFTED(i*8 + 7 downto i*8), Nbuf(SHIFTED)(i*8 + 7 downto i*8))
     }
+
+    val srcPixels = (FARG ## RAW_SARG).subdivideIn(16 bits)
+    for (i <- 0 to 3) {
+      val pos = RS_POS +^ resample_step * U(i, 2 bits)
+      val index = pos(18 downto 16)
+      RS_A(i*16 + 15 downto i*16) := srcPixels(index)
+      RS_B(i*16 + 15 downto i*16) := srcPixels(index + 1)
+      RS_W(i*6 + 5 downto i*6) := Mux(I.cmdResampleLinear, pos(15 downto 10).asBits, B(0, 6 bits))
+    }
+
+    // Y advances by half a word per output word, U and V by a quarter
+    val yuvY = RAW_SARG.subdivideIn(32 bits)((I.b_arg(2) ^ YUV_INDEX(0)).asUInt)
+    val yuvU = FARG.subdivideIn(16 bits)(I.b_arg2(2 downto 1) + YUV_INDEX)
+    val yuvV = TARG.subdivideIn(16 bits)(I.b_arg2(2 downto 1) + YUV_INDEX)
+    def yuvTerm(x: Bits, offset: Int, k: Int) : SInt = ((B"0" ## x).asSInt - offset) * S(k, 11 bits)
+    for (i <- 0 to 3) {
+      YUV_L(i) := yuvTerm(yuvY(i*8 + 7 downto i*8), 16, 298).resized
+    }
+    for (i <- 0 to 1) {
+      val u = yuvU(i*8 + 7 downto i*8)
+      val v = yuvV(i*8 + 7 downto i*8)
+      YUV_R(i) := yuvTerm(v, 128, 409).resized
+      YUV_G(i) := (yuvTerm(u, 128, -100) +^ yuvTerm(v, 128, -208)).resized
+      YUV_B(i) := yuvTerm(u, 128, 516).resized
+    }
+
+    val expandByte = RAW_SARG.subdivideIn(8 bits)(EXP_INDEX(3 downto 1))
+    EXP_BITS := Mux(I.expandMsbFirst, expandByte.reversed, expandByte).subdivideIn(4 bits)(EXP_INDEX(0).asUInt)
+
+    // Every 4 items read a 4x4 pixel block; results are produced from the previous block while the next one is read.
+    val transposeLines = Reg(Vec.fill(4)(Bits(64 bits)))
+    val transposeBlock = Reg(Vec.fill(4)(Bits(64 bits)))
+    when (isValid) {
+      transposeLines(TR_ROW) := RAW_SARG
+      when (TR_ROW === 3) {
+        for (i <- 0 to 2) transposeBlock(i) := transposeLines(i)
+        transposeBlock(3) := RAW_SARG
+      }
+    }
+    throwWhen(I.cmdTranspose & TR_SKIP)
+    val TR_RES = insert(Cat((0 to 3).map(i => transposeBlock(i).subdivideIn(16 bits)(TR_ROW))))
   }
 
   val Nr = new pip.Ctrl(4) {
@@ -334,14 +594,51 @@ class DmaController extends Component {
         RES((b+10) downto (b+ 5)) := ((SARG((b+10) downto (b+ 5)).asUInt +^ FARG((b+10) downto (b+ 5)).asUInt) >> 1).asBits;
         RES((b+15) downto (b+11)) := ((SARG((b+15) downto (b+11)).asUInt +^ FARG((b+15) downto (b+11)).asUInt) >> 1).asBits;
       }
+    } elsewhen (I.cmdBlend | I.cmdResample) {
+      for (i <- 0 to 3) {
+        val b = i * 16
+        val src = Mux(I.cmdResample, RS_B, SARG)((b+15) downto b)
+        val dst = Mux(I.cmdResample, RS_A, FARG)((b+15) downto b)
+        val alpha = Mux(I.cmdResample, RS_W((i*6+5) downto (i*6)).asUInt.resize(7 bits),
+                        Mux(I.cmdBlendRgab & src(5), U(64, 7 bits), I.alpha))
+        val src_g = Mux(I.cmdBlendRgab, src(10 downto 6) ## src(10), src(10 downto 5))
+        def blend(x: Bits, y: Bits) : Bits = {
+          val sum = x.asUInt * alpha +^ y.asUInt * (U(64, 7 bits) - alpha) + 32
+          (sum >> 6).resize(x.getWidth bits).asBits
+        }
+        RES((b+ 4) downto (b+ 0)) := blend(src(4 downto 0), dst(4 downto 0))
+        RES((b+10) downto (b+ 5)) := blend(src_g, dst(10 downto 5))
+        RES((b+15) downto (b+11)) := blend(src(15 downto 11), dst(15 downto 11))
+      }
+    } elsewhen (I.cmdYuv) {
+      def clamp(v: SInt) : Bits = {
+        val sum = (v + 128) >> 8
+        Mux(sum < 0, B(0, 8 bits), Mux(sum > 255, B(255, 8 bits), sum.asBits.resize(8 bits)))
+      }
+      for (i <- 0 to 3) {
+        val b = i * 16
+        val red = clamp(YUV_L(i) + YUV_R(i / 2))
+        val green = clamp(YUV_L(i) + YUV_G(i / 2))
+        val blue = clamp(YUV_L(i) + YUV_B(i / 2))
+        RES((b+15) downto b) := red(7 downto 3) ## green(7 downto 2) ## blue(7 downto 3)
+      }
+    } elsewhen (I.cmdExpand) {
+      for (i <- 0 to 3) {
+        RES((i*16+15) downto (i*16)) := Mux(EXP_BITS(i), expand_fg, expand_bg)
+      }
+    } elsewhen (I.cmdTranspose) {
+      RES := Ncalc.TR_RES
     } elsewhen (I.cmdMap) {
       RES := Ncalc.MAP_RES
     } otherwise {
       RES := SARG
     }
     writeResS.data := RES
-    writeResS.payload.mask := Mux(FIRST, I.wmask_first, B(0xff)) & Mux(LAST, I.wmask_last, B(0xff))
-    writeResS.valid := isFiring & ~DUMMY & ~I.cmdLoadMap
+    val expandMask = Cat((0 to 3).map(i => EXP_BITS(i) ## EXP_BITS(i)))
+    writeResS.payload.mask := Mux(FIRST, I.wmask_first, B(0xff)) & Mux(LAST, I.wmask_last, B(0xff)) &
+                              Mux(I.cmdExpandTransparent, expandMask, B(0xff))
+    writeResS.valid := isFiring & ~DUMMY & ~I.cmdLoadMap & ~I.cmdCrc
+    when (isFiring & ~DUMMY & I.cmdCrc) { crc_state := crc32Update(crc_state, SARG) }
   }
   mapWriteS.payload := RegNext(Nr(SARG))
   mapWriteS.valid := RegNext(Nr.isFiring & ~Nr(DUMMY) & I.cmdLoadMap)
@@ -355,6 +652,24 @@ class DmaController extends Component {
   val interrupt_en = RegInit(False)
   val instr_baddr = Reg(UInt(4 bits))
   val instr_next_read = RegInit(False)
+  val instr_pos = Reg(UInt(27 bits))  // address of the next command in 8-byte units
+
+  val jump_addr = Reg(UInt(27 bits))
+  val jump_counter = Reg(UInt(16 bits))
+
+  // Next command list, started without going idle when the current one is finished.
+  val link_addr = Reg(UInt(24 bits))
+  val link_counter = Reg(UInt(16 bits))
+  val link_pending = RegInit(False)
+  val link_taken = RegInit(False)
+
+  val loop_addr = Reg(UInt(27 bits))
+  val loop_instr_counter = Reg(UInt(16 bits))
+  val loop_remaining = Reg(UInt(16 bits))
+  val loop_read_inc = Reg(UInt(24 bits))
+  val loop_write_inc = Reg(UInt(24 bits))
+  val loop_read_offset = RegInit(U(0, 24 bits))
+  val loop_write_offset = RegInit(U(0, 24 bits))
 
   fetchAddr := (B"111111" ## instr_baddr).asUInt
   fetchS.ready := False
@@ -362,73 +677,218 @@ class DmaController extends Component {
   val startProcessing = False
   val isIdle = False
 
+  // Performance counters, wrap around. Any write to address 20 resets all of them.
+  val perf = new Area {
+    val busyCycles = RegInit(U(0, 32 bits))   // command FSM is not idle
+    val readBeats = RegInit(U(0, 32 bits))    // TileLink AccessAckData beats, including command fetch
+    val writeBeats = RegInit(U(0, 32 bits))   // TileLink PutFullData beats
+    val stallCycles = RegInit(U(0, 32 bits))  // command FSM waits for memory operations to finish
+    val commands = RegInit(U(0, 32 bits))     // commands fetched from the command list
+    val reset = False
+    val stall = False
+    val command = False
+  }
+
   val apb = Apb3SlaveFactory(io.apb)
   apb.readAndWrite(instr_addr, address = 0, bitOffset = 6)
   apb.readAndWrite(instr_counter, address = 4)
   apb.write(interrupt_en, address = 8)
   apb.read(isIdle, address = 8)
   apb.onWrite(4)( startProcessing := True )
+  apb.onWrite(8)( link_taken := False )
+  apb.readAndWrite(link_addr, address = 12, bitOffset = 6)
+  apb.write(link_counter, address = 16)
+  apb.read(link_pending, address = 16)
+  apb.onWrite(16)( link_pending := True )
+  apb.read(perf.busyCycles, address = 20)
+  apb.read(perf.readBeats, address = 24)
+  apb.read(perf.writeBeats, address = 28)
+  apb.read(perf.stallCycles, address = 32)
+  apb.read(perf.commands, address = 36)
+  apb.onWrite(20)( perf.reset := True )
+  apb.read(~crc_state, address = 40)
+  apb.onWrite(40)( crc_state := ~io.apb.PWDATA )
 
   val fsm = new StateMachine {
     val Idle : State = new State with EntryPoint {
       whenIsActive {
-        isIdle := True
+        isIdle := ~link_pending
         when (startProcessing) {
+          jump_addr := instr_addr @@ U(0, 3 bits)
+          jump_counter := io.apb.PWDATA(15 downto 0).asUInt
+          goto(Jump)
+        } elsewhen (link_pending) {
+          jump_addr := link_addr @@ U(0, 3 bits)
+          jump_counter := link_counter
+          link_pending := False
+          goto(Jump)
+        }
+      }
+    }
+    // Refills instruction buffer from jump_addr
+    val Jump : State = new State {
+      whenIsActive {
+        when (mem_counter === 0 && tl_id_busy === 0) {
           I.instr(63 downto 58) := DmaOpcode.READ_SYNC
           I.instr(57 downto 45) := B(8192 - 128, 13 bits)
-          I.instr(44 downto 32) := Mux(io.apb.PWDATA(15 downto 3).orR, B(0, 13 bits), B(8192 - 64, 13 bits))
-          I.instr(29 downto 6) := instr_addr.asBits
-          instr_addr := instr_addr + 2
-          instr_baddr := 0
+          I.instr(44 downto 32) := Mux(jump_counter +^ jump_addr(2 downto 0) > 8, B(0, 13 bits), B(8192 - 64, 13 bits))
+          I.instr(29 downto 6) := jump_addr(26 downto 3).asBits
+          I.cmdFetch := True
+          instr_addr := jump_addr(26 downto 3) + 2
+          instr_baddr := jump_addr(2 downto 0).resized
+          instr_pos := jump_addr
+          instr_counter := jump_counter
           instr_next_read := False
           goto(Parse)
+        } otherwise {
+          perf.stall := True
         }
       }
     }
+    // Lets instruction prefetch settle before returning to Fetch
+    val Next : State = new State {
+      whenIsActive { goto(Fetch) }
+    }
     val Fetch : State = new State {
       whenIsActive {
         fetchS.ready := True
         when (instr_counter === 0) {
-          when (mem_counter === 0 && tl_id_busy === 0) { goto(Idle) }
+          when (mem_counter === 0 && tl_id_busy === 0) {
+            when (link_pending) {
+              jump_addr := link_addr @@ U(0, 3 bits)
+              jump_counter := link_counter
+              link_pending := False
+              link_taken := True
+              goto(Jump)
+            } otherwise {
+              goto(Idle)
+            }
+          } otherwise {
+            perf.stall := True
+          }
         } elsewhen (instr_baddr(2 downto 0) === 0 && instr_next_read) {
           I.instr(63 downto 58) := DmaOpcode.READ
           I.instr(57 downto 45) := Mux(instr_baddr(3), B(8192 - 128, 13 bits), B(8192 - 64, 13 bits))
           I.instr(44 downto 32) := Mux(instr_baddr(3), B(8192 - 64, 13 bits), B(0, 13 bits))
           I.instr(29 downto 6) := instr_addr.asBits
+          I.cmdFetch := True
           instr_addr := instr_addr + 1
           instr_next_read := False
           goto(Parse)
         } elsewhen (fetchS.valid) {
           when (instr_baddr(2 downto 0).andR) { instr_next_read := True }
           I.instr := fetchS.payload
+          I.cmdFetch := False
           instr_baddr := instr_baddr + 1
+          instr_pos := instr_pos + 1
           instr_counter := instr_counter - 1
+          perf.command := True
           goto(Parse)
         }
       }
     }
     val Parse : State = new State {
       whenIsActive {
-        I.shift := Mux(I.opcode === DmaOpcode.SET, U(0, 3 bits), I.b_arg(2 downto 0))
-        I.shift_mask  := B(0xff) |>> I.b_arg(2 downto 0)
+        val cmdResample = I.opcode(5 downto 1) === B"10010"  // RESAMPLE or RESAMPLE_LINEAR
+        val cmdCrc = I.opcode === DmaOpcode.CRC32
+        I.shift := Mux(I.opcode === DmaOpcode.SET | cmdResample | cmdCrc, U(0, 3 bits), I.b_arg(2 downto 0))
+        I.shift_mask  := Mux(cmdResample | cmdCrc, B(0xff), B(0xff) |>> I.b_arg(2 downto 0))
         I.wmask_first := B(0xff) |<< I.b_from(2 downto 0)
         I.wmask_last  := B(0xff) |>> (U(0, 3 bits) - I.b_to(2 downto 0))
         I.cmdSet := I.opcode === DmaOpcode.SET
         I.cmdMixrgb := I.opcode === DmaOpcode.MIXRGB
+        I.cmdBlend := I.opcode(5 downto 1) === B"10001"  // BLEND or BLEND_RGAB
+        I.cmdBlendRgab := I.opcode === DmaOpcode.BLEND_RGAB
+        I.alpha := I.d32(31 downto 26).asUInt.resized
+        I.cmdResample := cmdResample
+        I.cmdResampleLinear := I.opcode === DmaOpcode.RESAMPLE_LINEAR
+        val cmdYuv = I.opcode === DmaOpcode.YUV420
+        I.cmdYuv := cmdYuv
+        I.cmdCrc := cmdCrc
+        val cmdExpand = I.opcode(5 downto 1) === B"00101"  // EXPAND or EXPAND_TRANSPARENT
+        I.cmdExpand := cmdExpand
+        I.cmdExpandTransparent := I.opcode === DmaOpcode.EXPAND_TRANSPARENT
+        I.expandMsbFirst := I.d32(13)
+        expand_nibble := (I.b_arg(0) ## B"0").asUInt
+        I.cmdTranspose := I.opcode === DmaOpcode.TRANSPOSE
+        transpose_read := 0
+        transpose_write := 0
+        transpose_arg_base := I.b_arg(12 downto 3)
+        transpose_res_base := I.b_from(12 downto 3)
+        resample_pos := I.resample_start
         I.cmdLoadMap := I.opcode === DmaOpcode.LOADMAP
-        val cmdMap = I.opcode(5 downto 3) === B"001"  // MAP2 or MAP4
+        val cmdMap = I.opcode(5 downto 1) === B"00100"  // MAP2 or MAP4
         I.cmdMap := cmdMap
         I.cmdMap2 := I.opcode === DmaOpcode.MAP1R2
         resAddr := I.b_from(12 downto 3)
-        arg1Addr := I.b_arg(12 downto 3)
-        arg2Addr := I.b_arg2(12 downto 3)
+        arg1Addr := Mux(cmdCrc, I.b_from(12 downto 3), I.b_arg(12 downto 3))
+        arg2Addr := Mux(cmdResample, I.b_arg(12 downto 3) + 1, I.b_arg2(12 downto 3))
+        arg3Addr := I.b_arg2(12 downto 3) + (I.d32(31 downto 26).asUInt << 3)
         arg2Turn := has_arg2
-        arg1RepeatCounter := 0
-        arg1Step := Mux(cmdMap, U"001", U"100")
+        arg3Turn := has_arg3
+        arg1RepeatCounter := Mux(cmdYuv | cmdExpand, I.b_arg(2 downto 1), U(0, 2 bits))
+        arg2RepeatCounter := Mux(cmdYuv, I.b_arg2(2 downto 1), U(0, 2 bits))
+        arg3RepeatCounter := Mux(cmdYuv, I.b_arg2(2 downto 1), U(0, 2 bits))
+        arg1Step := Mux(cmdMap | cmdExpand, U"001", Mux(cmdYuv, U"010", U"100"))
+        arg2Step := Mux(cmdYuv, U"001", U"100")
         mapWriteAddr := I.b_from(11 downto 3)
         work_counter := (I.b_to + 7)(12 downto 3) - I.b_from(12 downto 3)
-        when (I.opcode === M"0000--") {
-          when (mem_counter === 0 & ~d_last) { goto(MemOp) }
+
+        // Reads fill blocks [b_from/64, b_to/64); writes take words from b_from/8, one more block if it is unaligned.
+        val memBlocks = blockRange(I.b_from(12 downto 6), I.b_to(12 downto 6) + U(I.opcode(0) & I.b_from(5 downto 3).orR))
+        val memHazard = ~I.cmdFetch & I.b_to(12 downto 6) =/= I.b_from(12 downto 6) & (buf_pending & memBlocks).orR
+        // Buffer operations: the result range and conservatively sized argument ranges.
+        val lenBlocks = (I.b_to - I.b_from)(12 downto 6)
+        def argBlocks(start: UInt) : Bits = blockRange(start(12 downto 6), start(12 downto 6) + lenBlocks + 2)
+        val opBlocks = blockRange(I.b_from(12 downto 6), ((I.b_to +^ 63) >> 6).resize(7 bits)) |
+                       Mux(I.opcode === DmaOpcode.SET, B(0, 128 bits), argBlocks(Mux(cmdCrc, I.b_from, I.b_arg))) |
+                       Mux(has_arg2, argBlocks(I.b_arg2), B(0, 128 bits)) |
+                       Mux(has_arg3, argBlocks(I.b_arg2 + (I.d32(31 downto 26).asUInt << 6)), B(0, 128 bits))
+        // a buffer operation also must not overwrite data of a WRITE that is still being sent
+        val opHazard = ((buf_pending | buf_unissued) & opBlocks).orR | (mem_write & mem_counter =/= 0)
+
+        when (I.opcode === M"0-00--") {  // READ, WRITE, RECT_READ, RECT_WRITE and _SYNC variants
+          when (mem_counter === 0 & ~d_last & ~memHazard) { goto(MemOp) } otherwise { perf.stall := True }
+        } elsewhen (I.opcode === DmaOpcode.RECT_SETUP) {
+          rect_line_blocks := I.b_to(12 downto 6)
+          rect_src_stride := I.d32(15 downto 0).asSInt.resize(24 bits).asUInt
+          rect_dst_stride := I.d32(31 downto 16).asSInt.resize(24 bits).asUInt
+          goto(Next)
+        } elsewhen (I.opcode === DmaOpcode.RESAMPLE_SETUP) {
+          resample_step := I.d32(16 downto 0).asUInt
+          goto(Next)
+        } elsewhen (I.opcode === DmaOpcode.EXPAND_SETUP) {
+          expand_fg := I.d32(15 downto 0)
+          expand_bg := I.d32(31 downto 16)
+          goto(Next)
+        } elsewhen (I.opcode === DmaOpcode.JUMP) {
+          jump_addr := I.d32(29 downto 3).asUInt
+          jump_counter := I.instr(47 downto 32).asUInt
+          goto(Jump)
+        } elsewhen (I.opcode === DmaOpcode.LOOP) {
+          loop_addr := instr_pos
+          loop_instr_counter := instr_counter
+          loop_remaining := I.instr(47 downto 32).asUInt
+          loop_read_inc := I.d32(15 downto 0).asSInt.resize(24 bits).asUInt
+          loop_write_inc := I.d32(31 downto 16).asSInt.resize(24 bits).asUInt
+          loop_read_offset := 0
+          loop_write_offset := 0
+          goto(Next)
+        } elsewhen (I.opcode === DmaOpcode.ENDLOOP) {
+          when (loop_remaining > 1) {
+            loop_remaining := loop_remaining - 1
+            loop_read_offset := loop_read_offset + loop_read_inc
+            loop_write_offset := loop_write_offset + loop_write_inc
+            jump_addr := loop_addr
+            jump_counter := loop_instr_counter
+            goto(Jump)
+          } otherwise {
+            loop_read_offset := 0
+            loop_write_offset := 0
+            goto(Next)
+          }
+        } elsewhen (opHazard) {
+          perf.stall := True
         } otherwise {
           goto(DoWork)
         }
@@ -443,15 +903,23 @@ class DmaController extends Component {
     }
     val MemOp : State = new State {
       onEntry {
-        mem_addr := I.d32(29 downto 6).asUInt
+        val offset = Mux(I.cmdFetch, U(0, 24 bits), Mux(I.opcode(0), loop_write_offset, loop_read_offset))
+        val addr = I.d32(29 downto 6).asUInt + offset
+        mem_addr := addr
         mem_buf_base := I.b_from(12 downto 6)
         mem_counter := I.b_to(12 downto 6) - I.b_from(12 downto 6)
         mem_write := I.opcode(0)
+        mem_rect := I.opcode(4)
+        mem_stride := Mux(I.opcode(0), rect_dst_stride, rect_src_stride)
+        mem_line_addr := addr
+        mem_line_blocks := rect_line_blocks
+        mem_line_counter := rect_line_blocks
         tl_id_prev_busy := tl_id_busy
         tlDataOutValid := B(0, 2 bits)
         tlDataOutAddr := I.b_from(12 downto 3)
       }
       whenIsActive {
+        perf.stall := True
         when (I.opcode(1)) {
           when (mem_counter === 0 && tl_id_busy === 0) { goto(Fetch) }
         } otherwise {
@@ -461,7 +929,21 @@ class DmaController extends Component {
     }
   }
 
-  io.interrupt := interrupt_en & isIdle
+  io.interrupt := interrupt_en & (isIdle | link_taken)
+
+  when (perf.reset) {
+    perf.busyCycles := 0
+    perf.readBeats := 0
+    perf.writeBeats := 0
+    perf.stallCycles := 0
+    perf.commands := 0
+  } otherwise {
+    when (!fsm.isActive(fsm.Idle)) { perf.busyCycles := perf.busyCycles + 1 }
+    when (io.tl_bus.d.fire & tl_d_AccessAckData) { perf.readBeats := perf.readBeats + 1 }
+    when (io.tl_bus.a.fire & mem_write) { perf.writeBeats := perf.writeBeats + 1 }
+    when (perf.stall) { perf.stallCycles := perf.stallCycles + 1 }
+    when (perf.command) { perf.commands := perf.commands + 1 }
+  }
 }
 
 class DmaControllerFiber extends Area {
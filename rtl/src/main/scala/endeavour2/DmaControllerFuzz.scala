@@ -0,0 +1,74 @@
+package endeavour2
+
+import java.nio.{ByteBuffer, ByteOrder}
+import java.nio.file.{Files, Paths}
+
+import spinal.core._
+import spinal.core.sim._
+
+// Runs test vectors generated by software/dma_model/dma_fuzz (random programs + results of the C model)
+// and compares memory after every program with the model.
+object DmaControllerFuzz extends App {
+  val path = if (args.nonEmpty) args(0) else "dma_vectors.bin"
+  val data = ByteBuffer.wrap(Files.readAllBytes(Paths.get(path))).order(ByteOrder.LITTLE_ENDIAN)
+  assert(data.getInt() == 0x464d4144, "not a dma_fuzz vectors file")
+  val caseCount = data.getInt()
+  val imageSize = data.getInt()
+  val cmdAddr = data.getInt()
+  val imageWords = imageSize / 8
+
+  SimConfig.withTimeSpec(1 ns, 1 ps).compile(new DmaControllerTest()).doSimUntilVoid("fuzz", seed = 42){dut =>
+    dut.clockDomain.forkStimulus(5000)
+
+    def apbWrite(addr: Int, v: Long) = {
+      dut.io.apb.PSEL #= 1
+      dut.io.apb.PADDR #= addr
+      dut.io.apb.PWRITE #= true
+      dut.clockDomain.waitSampling()
+      dut.io.apb.PENABLE #= true
+      dut.io.apb.PWDATA #= v
+      dut.clockDomain.waitSamplingWhere(dut.io.apb.PREADY.toBoolean)
+      dut.io.apb.PSEL #= 0
+      dut.io.apb.PENABLE #= false
+      dut.io.apb.PWRITE #= false
+      dut.clockDomain.waitSampling()
+    }
+
+    def readImage(): Array[BigInt] = Array.fill(imageWords) {
+      val v = data.getLong()
+      if (v < 0) BigInt(v) + (BigInt(1) << 64) else BigInt(v)
+    }
+
+    val mem = dut.ram.thread.logic.mem
+    dut.clockDomain.waitSampling(5)
+
+    var failed = 0
+    for (c <- 0 until caseCount) {
+      val cmdCount = data.getInt()
+      val initial = readImage()
+      val expected = readImage()
+      for (i <- 0 until imageWords) mem.setBigInt(i, initial(i))
+
+      apbWrite(0, cmdAddr)
+      apbWrite(4, cmdCount)
+      apbWrite(8, 1)
+      waitUntil(dut.io.interrupt.toBoolean)
+      apbWrite(8, 0)
+
+      var mismatches = 0
+      for (i <- 0 until imageWords) {
+        val v = mem.getBigInt(i)
+        if (v != expected(i)) {
+          if (mismatches < 8) println(f"case $c: mem[0x${i*8}%05x] = ${v.toString(16)}, model ${expected(i).toString(16)}")
+          mismatches += 1
+        }
+      }
+      if (mismatches > 0) {
+        println(f"case $c: $mismatches mismatching words")
+        failed += 1
+      }
+    }
+    println(f"$caseCount cases, $failed failed")
+    if (failed == 0) simSuccess() else simFailure(f"$failed of $caseCount cases differ from the C model")
+  }
+}
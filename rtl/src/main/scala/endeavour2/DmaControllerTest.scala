@@ -116,6 +116,148 @@ object DmaControllerTest extends App {
       assert(v == expected, f"wrong result in Shifted MIXRGB at ${159*8}: ${v.toString(16)} != ${expected.toString(16)}")
     }
 
+    {  // BLEND
+      def pixel(i: Int) : Int = if (i < 128) (i * 0x9e37 + 0x1234) & 0xffff else ((i - 128) * 0x7f4b + 0x0f0f) & 0xffff
+      for (i <- 0 until 64) {
+        mem.setBigInt(i, (0 until 4).map(k => BigInt(pixel(i*4 + k)) << (k*16)).sum)
+      }
+      mem.setBigInt(cmdPos + 0, cmd(DmaOpcode.READ_SYNC, 0, 512, 0))
+      mem.setBigInt(cmdPos + 1, cmd(DmaOpcode.BLEND, 1024, 1024+256, (20L << 26) | (256 << 13) | 2))
+      mem.setBigInt(cmdPos + 2, cmd(DmaOpcode.BLEND_RGAB, 1280, 1280+256, (45L << 26) | (256 << 13) | 0))
+      mem.setBigInt(cmdPos + 3, cmd(DmaOpcode.WRITE_SYNC, 1024, 1536, 1024*8))
+      runDma(4)
+      def blend(s: Int, f: Int, alpha: Int, rgab: Boolean) : Int = {
+        val a = if (rgab && (s & 0x20) != 0) 64 else alpha
+        val sg = if (rgab) (((s >> 6) & 0x1f) << 1) | ((s >> 10) & 1) else (s >> 5) & 0x3f
+        def mix(x: Int, y: Int) = (x * a + y * (64 - a) + 32) >> 6
+        (mix(s >> 11, f >> 11) << 11) | (mix(sg, (f >> 5) & 0x3f) << 5) | mix(s & 0x1f, f & 0x1f)
+      }
+      for (i <- 0 until 64) {
+        val rgab = i >= 32
+        val expected = (0 until 4).map { k =>
+          val p = (i % 32) * 4 + k
+          BigInt(blend(pixel(if (rgab) p else p + 1), pixel(128 + p), if (rgab) 45 else 20, rgab)) << (k*16)
+        }.sum
+        val v = mem.getBigInt(1024 + i)
+        assert(v == expected, f"wrong result in ${if (rgab) "BLEND_RGAB" else "BLEND"} at ${i*8}: ${v.toString(16)} != ${expected.toString(16)}")
+      }
+    }
+
+    {  // RESAMPLE
+      def pixel(i: Int) : Int = (i * 0x9e37 + 0x1234) & 0xffff
+      for (i <- 0 until 16) {
+        mem.setBigInt(i, (0 until 4).map(k => BigInt(pixel(i*4 + k)) << (k*16)).sum)
+      }
+      val step = 0x6666  // 40 -> 100 pixels
+      val phase = 0x8000
+      mem.setBigInt(cmdPos + 0, cmd(DmaOpcode.READ_SYNC, 0, 128, 0))
+      mem.setBigInt(cmdPos + 1, cmd(DmaOpcode.RESAMPLE_SETUP, 0, 0, step))
+      mem.setBigInt(cmdPos + 2, cmd(DmaOpcode.RESAMPLE, 1024, 1024+200, (phase.toLong << 16) | 2))
+      mem.setBigInt(cmdPos + 3, cmd(DmaOpcode.RESAMPLE_LINEAR, 1280, 1280+200, (phase.toLong << 16) | 2))
+      mem.setBigInt(cmdPos + 4, cmd(DmaOpcode.WRITE_SYNC, 1024, 1536, 1024*8))
+      runDma(5)
+      def mix(x: Int, y: Int, a: Int) = (x * a + y * (64 - a) + 32) >> 6
+      for (j <- 0 until 100) {
+        val pos = (1 << 16) + phase + j * step
+        val a = pixel(pos >> 16)
+        val b = pixel((pos >> 16) + 1)
+        val w = (pos >> 10) & 63
+        val linear = (mix(b >> 11, a >> 11, w) << 11) | (mix((b >> 5) & 0x3f, (a >> 5) & 0x3f, w) << 5) | mix(b & 0x1f, a & 0x1f, w)
+        val nearestRes = (mem.getBigInt(1024 + j / 4) >> ((j % 4) * 16)).toInt & 0xffff
+        val linearRes = (mem.getBigInt(1056 + j / 4) >> ((j % 4) * 16)).toInt & 0xffff
+        assert(nearestRes == a, f"wrong result in RESAMPLE at pixel $j: $nearestRes%x != $a%x")
+        assert(linearRes == linear, f"wrong result in RESAMPLE_LINEAR at pixel $j: $linearRes%x != $linear%x")
+      }
+    }
+
+    {  // YUV420
+      def byte(i: Int) : Int = (i * 0x9e37 + (i >> 3) * 0x35) >> 4 & 0xff
+      for (i <- 0 until 64) {
+        mem.setBigInt(i, (0 until 8).map(k => BigInt(byte(i*8 + k)) << (k*8)).sum)
+      }
+      // 64 pixels; Y at 4, U at 2048 + 130 (V at U + 128) - buffer is loaded from address 0 at 0 and at 2048
+      mem.setBigInt(cmdPos + 0, cmd(DmaOpcode.READ_SYNC, 0, 512, 0))
+      mem.setBigInt(cmdPos + 1, cmd(DmaOpcode.READ_SYNC, 2048, 2048+512, 0))
+      mem.setBigInt(cmdPos + 2, cmd(DmaOpcode.YUV420, 1024, 1024+128, (2L << 26) | ((2048+130) << 13) | 4))
+      mem.setBigInt(cmdPos + 3, cmd(DmaOpcode.WRITE_SYNC, 1024, 1152, 1024*8))
+      runDma(4)
+      def clamp(v: Int) = Math.max(0, Math.min(255, (v + 128) >> 8))
+      for (j <- 0 until 64) {
+        val c = byte(4 + j) - 16
+        val d = byte(130 + j / 2) - 128
+        val e = byte(258 + j / 2) - 128
+        val r = clamp(298 * c + 409 * e)
+        val g = clamp(298 * c - 100 * d - 208 * e)
+        val b = clamp(298 * c + 516 * d)
+        val expected = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3)
+        val v = (mem.getBigInt(1024 + j / 4) >> ((j % 4) * 16)).toInt & 0xffff
+        assert(v == expected, f"wrong result in YUV420 at pixel $j: $v%x != $expected%x")
+      }
+    }
+
+    {  // EXPAND
+      val bitmap = Array.tabulate(64)(i => (i * 0x5b + 0x3c) & 0xff)
+      for (i <- 0 until 8) {
+        mem.setBigInt(i, (0 until 8).map(k => BigInt(bitmap(i*8 + k)) << (k*8)).sum)
+      }
+      for (i <- 64 until 128) mem.setBigInt(i, BigInt("5a5a5a5a5a5a5a5a", 16))
+      val fg = 0xf800
+      val bg = 0x07e0
+      mem.setBigInt(cmdPos + 0, cmd(DmaOpcode.READ_SYNC, 0, 1024, 0))
+      mem.setBigInt(cmdPos + 1, cmd(DmaOpcode.EXPAND_SETUP, 0, 0, (bg.toLong << 16) | fg))
+      mem.setBigInt(cmdPos + 2, cmd(DmaOpcode.EXPAND, 512, 512+256, 3))
+      mem.setBigInt(cmdPos + 3, cmd(DmaOpcode.EXPAND_TRANSPARENT, 768, 768+250, (1 << 13) | 21))
+      mem.setBigInt(cmdPos + 4, cmd(DmaOpcode.WRITE_SYNC, 512, 1024, 512))
+      runDma(5)
+      def bit(byte: Int, j: Int, msbFirst: Boolean) : Boolean = {
+        val b = bitmap(byte + j / 8)
+        ((b >> (if (msbFirst) 7 - j % 8 else j % 8)) & 1) != 0
+      }
+      for (i <- 64 until 128) {
+        val expected = (0 until 4).map { k =>
+          val j = (i - 64) * 4 + k
+          val p = if (j < 128) {
+            if (bit(3, j, false)) fg else bg
+          } else if (j - 128 < 125 && bit(21, j - 128, true)) fg else 0x5a5a
+          BigInt(p) << (k*16)
+        }.sum
+        val v = mem.getBigInt(i)
+        assert(v == expected, f"wrong result in EXPAND at ${i*8}: ${v.toString(16)} != ${expected.toString(16)}")
+      }
+    }
+
+    {  // TRANSPOSE
+      def pixel(line: Int, col: Int) : Int = (line << 8) | (col * 3 + 1)
+      for (i <- 0 until 256) {
+        mem.setBigInt(i, (0 until 4).map(k => BigInt(pixel(i / 8, (i % 8) * 4 + k)) << (k*16)).sum)
+      }
+      mem.setBigInt(cmdPos + 0, cmd(DmaOpcode.READ_SYNC, 0, 2048, 0))
+      mem.setBigInt(cmdPos + 1, cmd(DmaOpcode.TRANSPOSE, 4096, 6144, 0))
+      mem.setBigInt(cmdPos + 2, cmd(DmaOpcode.WRITE_SYNC, 4096, 6144, 4096))
+      runDma(3)
+      for (i <- 0 until 256) {
+        val expected = (0 until 4).map(k => BigInt(pixel((i % 8) * 4 + k, i / 8)) << (k*16)).sum
+        val v = mem.getBigInt(512 + i)
+        assert(v == expected, f"wrong result in TRANSPOSE at ${i*8}: ${v.toString(16)} != ${expected.toString(16)}")
+      }
+    }
+
+    {  // CRC32
+      val bytes = Array.tabulate(1024)(i => ((i * 0x9e37) >> 5).toByte)
+      for (i <- 0 until 128) {
+        mem.setBigInt(i, (0 until 8).map(k => BigInt(bytes(i*8 + k) & 0xff) << (k*8)).sum)
+      }
+      mem.setBigInt(cmdPos + 0, cmd(DmaOpcode.READ_SYNC, 0, 1024, 0))
+      mem.setBigInt(cmdPos + 1, cmd(DmaOpcode.CRC32, 8, 520, 0))
+      mem.setBigInt(cmdPos + 2, cmd(DmaOpcode.CRC32, 520, 1024, 0))
+      apbWrite(40, 0)
+      runDma(3)
+      val crc = new java.util.zip.CRC32()
+      crc.update(bytes, 8, 1016)
+      val v = apbRead(40)
+      assert(v == crc.getValue, f"wrong result in CRC32: $v%x != ${crc.getValue}%x")
+    }
+
     {  // Set
       mem.setBigInt(cmdPos + 0, cmd(DmaOpcode.SET, 0, 128, 0xaaaaaaaaL))
       mem.setBigInt(cmdPos + 1, cmd(DmaOpcode.SET, 64, 64+2, 0xffffffffL))
@@ -169,6 +311,137 @@ object DmaControllerTest extends App {
       }
     }
 
+    {  // RECT
+      for (i <- 0 until 1024) {
+        mem.setBigInt(i, BigInt(i))
+      }
+      for (i <- 1024 until 4096) {
+        mem.setBigInt(i, 0)
+      }
+      // 5 lines of 128 bytes: read with stride 256 starting at byte 64, write with stride -512 starting at byte 3072*8
+      val strides = (((-512L / 64) & 0xffff) << 16) | (256 / 64)
+      mem.setBigInt(cmdPos + 0, cmd(DmaOpcode.RECT_SETUP, 0, 128, strides))
+      mem.setBigInt(cmdPos + 1, cmd(DmaOpcode.RECT_READ_SYNC, 1024, 1024 + 128*5, 64))
+      mem.setBigInt(cmdPos + 2, cmd(DmaOpcode.RECT_WRITE_SYNC, 1024, 1024 + 128*5, 3072*8))
+      runDma(3)
+      for (line <- 0 until 5; i <- 0 until 16) {
+        val expected = BigInt(8 + line*32 + i)
+        val v = mem.getBigInt(3072 - line*64 + i)
+        assert(v == expected, f"wrong result in RECT at line $line word $i: ${v.toString(16)} != ${expected.toString(16)}")
+      }
+      for (line <- 0 until 5) {
+        assert(mem.getBigInt(3072 - line*64 + 16) == 0, "RECT wrote outside of the line")
+      }
+    }
+
+    {  // LOOP
+      for (i <- 0 until 1024) {
+        mem.setBigInt(i, BigInt(i))
+      }
+      for (i <- 2048 until 3072) {
+        mem.setBigInt(i, 0)
+      }
+      // copy every other 128-byte block to a contiguous range, then check that the loop offsets are reset
+      val incs = ((128L / 64) << 16) | (256 / 64)
+      mem.setBigInt(cmdPos + 0, cmd(DmaOpcode.LOOP, 0, 6, incs))
+      mem.setBigInt(cmdPos + 1, cmd(DmaOpcode.READ_SYNC, 0, 128, 0))
+      mem.setBigInt(cmdPos + 2, cmd(DmaOpcode.WRITE_SYNC, 0, 128, 2048*8))
+      mem.setBigInt(cmdPos + 3, cmd(DmaOpcode.ENDLOOP, 0, 0, 0))
+      mem.setBigInt(cmdPos + 4, cmd(DmaOpcode.SET, 0, 64, 0x12345678L))
+      mem.setBigInt(cmdPos + 5, cmd(DmaOpcode.WRITE, 0, 64, 3000*8))
+      runDma(6)
+      for (k <- 0 until 6; i <- 0 until 16) {
+        val v = mem.getBigInt(2048 + k*16 + i)
+        assert(v == BigInt(k*32 + i), f"wrong result in LOOP at block $k word $i: ${v.toString(16)}")
+      }
+      assert(mem.getBigInt(2048 + 6*16) == 0, "LOOP executed too many iterations")
+      assert(mem.getBigInt(3000) == BigInt("1234567812345678", 16), "wrong address after LOOP")
+    }
+
+    {  // JUMP
+      for (i <- 3104 until 3136) {
+        mem.setBigInt(i, 0)
+      }
+      mem.setBigInt(cmdPos + 0, cmd(DmaOpcode.SET, 0, 64, 0xaaaaaaaaL))
+      mem.setBigInt(cmdPos + 1, cmd(DmaOpcode.JUMP, 0, 3, (cmdPos + 6) * 8))
+      mem.setBigInt(cmdPos + 2, cmd(DmaOpcode.WRITE, 0, 64, 3120*8))  // skipped
+      mem.setBigInt(cmdPos + 6, cmd(DmaOpcode.WRITE, 0, 64, 3104*8))
+      mem.setBigInt(cmdPos + 7, cmd(DmaOpcode.SET, 0, 64, 0xbbbbbbbbL))
+      mem.setBigInt(cmdPos + 8, cmd(DmaOpcode.WRITE, 0, 64, 3112*8))
+      mem.setBigInt(cmdPos + 9, cmd(DmaOpcode.WRITE, 0, 64, 3128*8))  // out of the jump count
+      runDma(2)
+      assert(mem.getBigInt(3104) == BigInt("aaaaaaaaaaaaaaaa", 16), "wrong result in JUMP")
+      assert(mem.getBigInt(3112) == BigInt("bbbbbbbbbbbbbbbb", 16), "wrong result in JUMP")
+      assert(mem.getBigInt(3120) == 0, "command after JUMP is executed")
+      assert(mem.getBigInt(3128) == 0, "JUMP count is ignored")
+    }
+
+    {  // Link
+      mem.setBigInt(3200, 0)
+      mem.setBigInt(3208, 0)
+      mem.setBigInt(cmdPos + 0, cmd(DmaOpcode.SET, 0, 64, 0x11111111L))
+      mem.setBigInt(cmdPos + 1, cmd(DmaOpcode.WRITE, 0, 64, 3200*8))
+      mem.setBigInt(cmdPos + 16, cmd(DmaOpcode.SET, 0, 64, 0x22222222L))
+      mem.setBigInt(cmdPos + 17, cmd(DmaOpcode.WRITE, 0, 64, 3208*8))
+      apbWrite(0, cmdPos * 8)
+      apbWrite(4, 2)
+      apbWrite(12, (cmdPos + 16) * 8)
+      apbWrite(16, 2)
+      while (apbRead(16) != 0 || apbRead(8) == 0) {}
+      assert(mem.getBigInt(3200) == BigInt("1111111111111111", 16), "wrong result in Link")
+      assert(mem.getBigInt(3208) == BigInt("2222222222222222", 16), "linked list is not executed")
+    }
+
+    {  // Buffer hazards: asynchronous READ/WRITE without _SYNC
+      def word(i: Int) : BigInt = (BigInt(i * 0x2545f491L & 0xffffffffL) << 32) | (i ^ 0x5a5a)
+      for (i <- 0 until 512) mem.setBigInt(i, word(i))
+      val program = Seq(
+        cmd(DmaOpcode.READ, 0, 1024, 0),  // ping-pong copy of 4 KB through two buffer banks
+        cmd(DmaOpcode.READ, 1024, 2048, 1024),
+        cmd(DmaOpcode.WRITE, 0, 1024, 16384),
+        cmd(DmaOpcode.READ, 0, 1024, 2048),
+        cmd(DmaOpcode.WRITE, 1024, 2048, 16384 + 1024),
+        cmd(DmaOpcode.READ, 1024, 2048, 3072),
+        cmd(DmaOpcode.WRITE, 0, 1024, 16384 + 2048),
+        cmd(DmaOpcode.WRITE, 1024, 2048, 16384 + 3072),
+        cmd(DmaOpcode.READ, 2048, 3072, 0),
+        cmd(DmaOpcode.COPY, 3072, 4096, 2048),  // waits for the READ
+        cmd(DmaOpcode.WRITE, 3072, 4096, 24576),
+        cmd(DmaOpcode.SET, 3072, 4096, 0x77777777L),  // waits until the WRITE has sent the data
+        cmd(DmaOpcode.WRITE, 3072, 4096, 24576 + 1024),
+        cmd(DmaOpcode.READ, 4096, 7168, 0),
+        cmd(DmaOpcode.COPY, 1024, 1088, 7104),  // last block of the READ, not requested yet when COPY is parsed
+        cmd(DmaOpcode.WRITE, 1024, 1088, 28672))
+      for ((c, i) <- program.zipWithIndex) mem.setBigInt(cmdPos + i, c)
+      runDma(program.size)
+      for (i <- 0 until 512) {
+        assert(mem.getBigInt(2048 + i) == word(i), f"wrong result of ping-pong copy at ${i*8}")
+      }
+      for (i <- 0 until 128) {
+        assert(mem.getBigInt(3072 + i) == word(i), f"READ -> COPY hazard at ${i*8}")
+        assert(mem.getBigInt(3072 + 128 + i) == BigInt("7777777777777777", 16), f"WRITE -> SET hazard at ${i*8}")
+      }
+      for (i <- 0 until 8) {
+        assert(mem.getBigInt(3584 + i) == word(376 + i), f"hazard on unrequested READ blocks at ${i*8}")
+      }
+    }
+
+    {  // Performance counters
+      apbWrite(20, 0)  // reset
+      mem.setBigInt(cmdPos + 0, cmd(DmaOpcode.SET, 0, 64, 0x33333333L))
+      mem.setBigInt(cmdPos + 1, cmd(DmaOpcode.WRITE_SYNC, 0, 64, 3200*8))
+      mem.setBigInt(cmdPos + 2, cmd(DmaOpcode.READ_SYNC, 0, 128, 3200*8))
+      runDma(3)
+      val busy = apbRead(20)
+      val stall = apbRead(32)
+      assert(apbRead(24) == 24, "wrong read beat count")  // 2 blocks + 1 block of commands
+      assert(apbRead(28) == 8, "wrong write beat count")
+      assert(apbRead(36) == 3, "wrong command count")
+      assert(stall > 0 && busy > stall, "wrong busy/stall cycles")
+      apbWrite(20, 0)
+      assert(apbRead(20) == 0 && apbRead(24) == 0 && apbRead(36) == 0, "performance counters are not reset")
+    }
+
     dut.clockDomain.waitSampling(50)
 
     simSuccess()
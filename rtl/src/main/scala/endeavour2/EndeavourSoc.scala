@@ -506,7 +506,7 @@ class EndeavourSoc(coresParams: List[ParamSimple],
     }
     if (withDma) {
       apbSlaves ++= List[(Apb3, SizeMapping)](
-        dma_ctrl.apb             -> (0x5000, 16)
+        dma_ctrl.apb             -> (0x5000, 64)
       )
     }
     val apbDecoder = Apb3Decoder(
@@ -12,6 +12,7 @@ void memset_1mb_dma(unsigned* dst, unsigned v);
 void memcpy_1mb(unsigned* dst, const unsigned* src);
 void memcpy_1mb_prefetch(unsigned* dst, const unsigned* src);
 void memcpy_1mb_dma(unsigned* dst, const unsigned* src);
+void memcpy_1mb_dma_async(unsigned* dst, const unsigned* src);
 
 unsigned sparse_agg_xor_1mb(const unsigned* src);
 void sparse_inplace_xor_1mb(unsigned* data, unsigned v);
@@ -192,6 +193,66 @@ static void run_benchmarks_th() {
   }
 }
 
+// Not a part of run_benchmarks until the buffer hazard tracking of DmaController is verified on hardware:
+// compares the READ_SYNC/WRITE_SYNC copy with the ping-pong copy that has no _SYNC commands.
+int run_dma_async_benchmark() {
+  unsigned* page1 = (unsigned*)(RAM_BASE + 0x080000);
+  unsigned* page2 = (unsigned*)(RAM_BASE + 0x700000);
+  if (BOARD_REGS->ram_size < 0x800000 || !(BOARD_REGS->cpu_features[get_hartid()] & CPU_FEATURES_DMA)) {
+    printf("[ERROR] No DMA controller\n");
+    return -1;
+  }
+  test_memcpy_fill(page2);
+  memset_1mb(page1, 0x222);
+  unsigned start = time_100nsec();
+  memcpy_1mb_dma(page1, page2);
+  print_mem_bench_res("memcpy dma (_SYNC)", start);
+  test_memcpy_check(page1);
+
+  test_memcpy_fill(page2);
+  memset_1mb(page1, 0x222);
+  start = time_100nsec();
+  memcpy_1mb_dma_async(page1, page2);
+  print_mem_bench_res("memcpy dma (async)", start);
+  test_memcpy_check(page1);
+  return 0;
+}
+
+// Not a part of run_benchmarks: it rewrites the first 1 MB of the card (partition table, often the start of the
+// first partition) with its own content, so a reset or a power loss in the middle can damage the data.
+int run_sdcard_write_benchmark() {
+  unsigned* page1 = (unsigned*)(RAM_BASE + 0x080000);
+  unsigned* page2 = (unsigned*)(RAM_BASE + 0x700000);
+  if (get_sdcard_sector_count() < 2048) {
+    printf("[ERROR] No SD card\n");
+    return -1;
+  }
+  printf("WARNING: rewriting sectors 0..2047 of the SD card, don't reset or power off the board\n");
+  if (sdread(page1, 0, 2048) != 2048) {
+    printf("[ERROR] SD card read failed\n");
+    return -1;
+  }
+  // writes back the same data, so the content of the card doesn't change
+  unsigned start = time_100nsec();
+  unsigned count = sdwrite(page1, 0, 2048);
+  print_mem_bench_res("SD card write", start);
+  if (count != 2048) {
+    printf("[ERROR] SD card write failed, transfered %u of 2048 sectors\n", count);
+    return -1;
+  }
+  if (sdread(page2, 0, 2048) != 2048) {
+    printf("[ERROR] SD card read failed\n");
+    return -1;
+  }
+  for (int i = 0; i < 1024*1024/4; ++i) {
+    if (page1[i] != page2[i]) {
+      printf("[ERROR] SD card write mismatch: sector %u\n", i / 128);
+      return -1;
+    }
+  }
+  return 0;
+}
+
 void run_benchmarks() {
   run_benchmarks_th();
   for (int hartid = 1; hartid < BOARD_REGS->hart_count; ++hartid) {
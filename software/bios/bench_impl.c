@@ -83,6 +83,32 @@ void memcpy_1mb_dma(unsigned* restrict dst, const unsigned* restrict src) {
   while (!DMA_REGS->int_stat);
 }
 
+// Copies 512-byte chunks through two buffer banks: the next chunk is read while the previous one is written.
+// The controller delays every WRITE until its bank is filled, so no _SYNC commands are needed.
+void memcpy_1mb_dma_async(unsigned* restrict dst, const unsigned* restrict src) {
+  volatile struct DmaCmd { unsigned lo, hi; }* commands = (void*)(RAM_BASE + BIOS_SIZE);
+  enum { CHUNK = 512, CHUNKS = 1024*1024/CHUNK };
+
+  unsigned n = 0;
+  commands[n].lo = (unsigned long)src;
+  commands[n++].hi = DMA_CMD_HI(DMA_READ, 0, CHUNK);
+  for (unsigned i = 0; i < CHUNKS; ++i) {
+    unsigned bank = (i & 1) * CHUNK;
+    if (i + 1 < CHUNKS) {
+      commands[n].lo = (unsigned long)src + (i + 1) * CHUNK;
+      commands[n++].hi = DMA_CMD_HI(DMA_READ, CHUNK - bank, 2*CHUNK - bank);
+    }
+    commands[n].lo = (unsigned long)dst + i * CHUNK;
+    commands[n++].hi = DMA_CMD_HI(DMA_WRITE, bank, bank + CHUNK);
+  }
+
+  DMA_REGS->cmdAddress = (void*)commands;
+  asm volatile("fence ow, ow");
+  DMA_REGS->cmdCount = n;
+  asm volatile("fence o, i");
+  while (!DMA_REGS->int_stat);
+}
+
 /*void memcpy_1mb_zicboz(unsigned* restrict dst, const unsigned* restrict src) {
   for (int i = 0; i < 1024*1024/4; i += 16) {
     asm volatile("prefetch.r 64(%0)" :: "r" (src+i));
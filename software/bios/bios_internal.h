@@ -25,9 +25,12 @@ int full_memtest(unsigned iter_count, unsigned modifier);
 
 int run_binary(void* addr, int argc, void** argv);
 void run_benchmarks();
+int run_sdcard_write_benchmark();  // returns 0 on success
+int run_dma_async_benchmark();     // returns 0 on success
 
 void beep(unsigned duration_ms, unsigned frequency, int volume);
 void playWav(void* filePtr, int volume);
+void playWavStream(struct FileStream* stream, int volume);
 
 void run_console();
 int run_command(const char* cmd_line);
@@ -47,6 +50,7 @@ int print_display_info();
 void init_sdcard();
 unsigned get_sdcard_rca();
 unsigned get_sdcard_sector_count();
+unsigned get_sdcard_bus_mode();  // bits 0..15 - bus clock in MHz, bits 16..20 - sample shift
 unsigned sdread(unsigned* dst, unsigned sector, unsigned sector_count);
 unsigned sdwrite(const unsigned* src, unsigned sector, unsigned sector_count);
 
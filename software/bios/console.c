@@ -19,6 +19,8 @@ static int load_file(const char* path, void* addr, unsigned max_size) {
     printf("No selected EXT2 fs\n");
     return -1;
   }
+  int size = boot_catalog_read(path, addr, max_size);
+  if (size >= 0) return size;
   const struct Inode* inode = find_inode(path);
   if (!inode || !is_regular_file(inode)) {
     printf("File not found\n");
@@ -35,6 +37,21 @@ static int load_file(const char* path, void* addr, unsigned max_size) {
   return inode->size_lo;
 }
 
+#define STREAM_CHUNK_SIZE 0x10000
+
+// Opens a file for reading in chunks of STREAM_CHUNK_SIZE; uses MAIN_BUF for the two chunk buffers.
+static int open_stream(const char* path, struct FileStream* stream) {
+  if (!is_ext2_reader_initialized()) {
+    printf("No selected EXT2 fs\n");
+    return -1;
+  }
+  if (ext2_stream_open(stream, path, MAIN_BUF, MAIN_BUF + STREAM_CHUNK_SIZE, STREAM_CHUNK_SIZE) < 0) {
+    printf("File not found\n");
+    return -1;
+  }
+  return 0;
+}
+
 static int cmd_write(const char* args) {
   unsigned long addr;
   unsigned val;
@@ -58,7 +75,14 @@ static int cmd_memtest(const char* args) {
   return CMD_OK;
 }
 
-static int cmd_benchmark() {
+static int cmd_benchmark(const char* args) {
+  if (strcmp(args, "sdwrite") == 0) {
+    return run_sdcard_write_benchmark() == 0 ? CMD_OK : CMD_FAILED;
+  } else if (strcmp(args, "dma_async") == 0) {
+    return run_dma_async_benchmark() == 0 ? CMD_OK : CMD_FAILED;
+  } else if (*args) {
+    return CMD_INVALID_ARGS;
+  }
   run_benchmarks();
   return CMD_OK;
 }
@@ -197,41 +221,91 @@ static int cmd_sound(const char* args) {
     while (*args == ' ' || (*args >= '0' && *args <= '9')) args++;
   }
   if (args[0] != '8') {
-    if (load_file(args, MAIN_BUF, 0x10000000) <= 0) return CMD_FAILED;
-    addr = (unsigned long)MAIN_BUF;
-  } else if (sscanf(args, "%lx", &addr) == 0) return CMD_INVALID_ARGS;
+    struct FileStream stream;
+    if (open_stream(args, &stream) < 0) return CMD_FAILED;
+    playWavStream(&stream, volume);
+    return CMD_OK;
+  }
+  if (sscanf(args, "%lx", &addr) == 0) return CMD_INVALID_ARGS;
   playWav((void*)addr, volume);
   return CMD_OK;
 }
 
+struct BmpInfo {
+  unsigned bitmap_offset;
+  unsigned bytes_per_line;
+  unsigned height;
+};
+
+// Checks the BMP header and returns the file size expected for the given header, or 0 if the image is not supported.
+static unsigned parse_bmp_header(const char* bmp, struct BmpInfo* info) {
+  unsigned short width = *(unsigned short*)(bmp + 18);
+  unsigned short bits_per_pixel = *(unsigned short*)(bmp + 28);
+  info->bitmap_offset = *(unsigned short*)(bmp + 10);
+  info->height = *(unsigned short*)(bmp + 22);
+  info->bytes_per_line = (width * 2 + 3) & ~3;
+  if (bits_per_pixel != 16) return 0;
+  return info->bitmap_offset + info->bytes_per_line * info->height;
+}
+
+static int unsupported_bmp() {
+  printf("Unsupported image. Expected RGB565 BMP without color table.\n");
+  return CMD_FAILED;
+}
+
+// Copies `size` bytes of a BMP file starting from file offset `pos` to the graphic frame buffer.
+// BMP rows are stored bottom-up.
+static void blit_bmp_part(const struct BmpInfo* info, unsigned pos, const char* src, unsigned size) {
+  char* frame_buffer = VIDEO_REGS->graphicAddr;
+  while (size > 0) {
+    unsigned n;
+    if (pos < info->bitmap_offset) {
+      n = info->bitmap_offset - pos;
+      if (n > size) n = size;
+    } else {
+      unsigned row = (pos - info->bitmap_offset) / info->bytes_per_line;
+      unsigned col = (pos - info->bitmap_offset) % info->bytes_per_line;
+      if (row >= info->height) return;
+      n = info->bytes_per_line - col;
+      if (n > size) n = size;
+      char* dst = frame_buffer + (info->height - row - 1) * GRAPHIC_LINE_SIZE + col;
+      for (int i = 0; i < n; ++i) dst[i] = src[i];
+    }
+    pos += n;
+    src += n;
+    size -= n;
+  }
+}
+
 static int cmd_wallpaper(const char* args) {
   if (*args == 0 || strcmp(args, "off") == 0) {
     VIDEO_REGS->cfg &= ~VIDEO_GRAPHIC_ON;
     return CMD_OK;
   }
-  unsigned long addr;
-  int size = 0;
+  struct BmpInfo info;
   if (args[0] != '8') {
-    size = load_file(args, MAIN_BUF, 0x1000000);
+    struct FileStream stream;
+    void* chunk;
+    if (open_stream(args, &stream) < 0) return CMD_FAILED;
+    int size = ext2_stream_next_chunk(&stream, &chunk);
     if (size <= 30) return CMD_FAILED;
-    addr = (unsigned long)MAIN_BUF;
-  } else if (sscanf(args, "%lx", &addr) == 0) return CMD_INVALID_ARGS;
-
-  const char* wallpaper_bmp = (char*)addr;
-  unsigned short bitmap_offset = *(unsigned short*)(wallpaper_bmp + 10);
-  unsigned short width = *(unsigned short*)(wallpaper_bmp + 18);
-  unsigned short height = *(unsigned short*)(wallpaper_bmp + 22);
-  unsigned short bits_per_pixel = *(unsigned short*)(wallpaper_bmp + 28);
-  unsigned bytes_per_line = (width * 2 + 3) & ~3;
-  if ((size && size != bitmap_offset + bytes_per_line * height) || bits_per_pixel != 16) {
-    printf("Unsupported image. Expected RGB565 BMP without color table.\n");
-    return CMD_FAILED;
-  }
-  char* frame_buffer  = VIDEO_REGS->graphicAddr;
-  for (int j = 0; j < height; ++j) {
-    const char* src = wallpaper_bmp + bitmap_offset + (height-j-1) * bytes_per_line;
-    char* dst = frame_buffer + j * GRAPHIC_LINE_SIZE;
-    for (int i = 0; i < bytes_per_line; ++i) dst[i] = src[i];
+    if (parse_bmp_header(chunk, &info) != stream.file_size) return unsupported_bmp();
+    unsigned pos = 0;
+    while (size > 0) {
+      blit_bmp_part(&info, pos, chunk, size);
+      pos += size;
+      size = ext2_stream_next_chunk(&stream, &chunk);
+    }
+    if (size < 0) {
+      printf("IO error\n");
+      return CMD_FAILED;
+    }
+  } else {
+    unsigned long addr;
+    if (sscanf(args, "%lx", &addr) == 0) return CMD_INVALID_ARGS;
+    unsigned size = parse_bmp_header((char*)addr, &info);
+    if (!size) return unsupported_bmp();
+    blit_bmp_part(&info, 0, (char*)addr, size);
   }
   VIDEO_REGS->cfg |= VIDEO_GRAPHIC_ON;
   return CMD_OK;
@@ -284,6 +358,11 @@ static int cmd_disk(const char* args) {
   return res < 0 ? CMD_FAILED : CMD_OK;
 }
 
+static int cmd_fscache() {
+  print_ext2_cache_stats();
+  return CMD_OK;
+}
+
 static int cmd_textstyle(const char* args) {
   int fg = 0xffffff40, bg = 0;
   sscanf(args, "%x %x", &fg, &bg);
@@ -411,7 +490,7 @@ static const struct ConsoleCommand commands[] = {
   {cmd_write,      "W",           "addr val",                "write 4 bytes (hex value) to given address (hex)"},
   {cmd_read,       "R",           "addr",                    "load 4 bytes from given address (hex value)"},
   {cmd_memtest,    "memtest",     "[iter_count] [seed]",     "run full memtest"},
-  {cmd_benchmark,  "benchmark",   "",                        "run benchmarks"},
+  {cmd_benchmark,  "benchmark",   "[sdwrite/dma_async]",     "run benchmarks; \"sdwrite\" measures SD card write speed instead (rewrites the first 1 MB of the card), \"dma_async\" compares DMA memcpy with and without _SYNC"},
   {cmd_uart,       "uart",        "addr size",               "receive size (decimal) bytes via UART with baud rate 12 MHz"},
   {cmd_crc32,      "crc32",       "addr size [expected]",    "calculate crc32 of data in RAM"},
   {cmd_flash_bios, "flash_bios",  "addr crc32",              "write BIOS image (32 KB) from given address in RAM to SPI flash"},
@@ -419,7 +498,8 @@ static const struct ConsoleCommand commands[] = {
   {cmd_battery,    "battery",     "",                        "print battery status"},
   {cmd_display,    "display",     "WIDTHxHEIGHT",            "set display resolution; supports custom mode, e.g.: \"display custom 25175000 640 656 752 800 480 490 492 525\""},
   {cmd_textstyle,  "textstyle",   "fg bg",                   "set text style; fg and bg are colors in hex format RRGGBBAA; alpha range is from 0 (transparent) to 64"},
-  {cmd_disk,       "disk",        "sd/sd1/sd2/sd3/sd4",      "select sdcard partition for file access (only EXT2 supported)"},
+  {cmd_disk,       "disk",        "sd/sd1/sd2/sd3/sd4",      "select sdcard partition for file access (EXT2/EXT4)"},
+  {cmd_fscache,    "fscache",     "",                        "print EXT2 metadata cache statistics"},
   {cmd_ls,         "ls",          "path",                    "show files"},
   {cmd_cat,        "cat",         "path",                    "print text file"},
   {cmd_eval,       "eval",        "path",                    "run commands from given text file"},
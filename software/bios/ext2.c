@@ -32,9 +32,71 @@ struct Superblock {
   // extended superblock (version >= 1)
   uint32_t first_non_reserved_inode;
   uint16_t inode_size;
+  uint16_t block_group_nr;
+  uint32_t feature_compat;
+  uint32_t feature_incompat;
+  uint32_t feature_ro_compat;
+  unsigned char uuid[16];
+  char volume_name[16];
+  char last_mounted[64];
+  uint32_t algorithm_usage_bitmap;
+  unsigned char prealloc_blocks;
+  unsigned char prealloc_dir_blocks;
+  uint16_t reserved_gdt_blocks;
+  unsigned char journal_uuid[16];
+  uint32_t journal_inode;
+  uint32_t journal_dev;
+  uint32_t last_orphan;
+  uint32_t hash_seed[4];
+  unsigned char def_hash_version;
+  unsigned char journal_backup_type;
+  uint16_t group_desc_size;  // only if INCOMPAT_64BIT
+  uint32_t default_mount_opts;
+  uint32_t first_meta_bg;
+  uint32_t mkfs_time;
+  uint32_t journal_blocks[17];
+  uint32_t block_count_hi;
+  uint32_t reserved_block_count_hi;
+  uint32_t free_block_count_hi;
+  uint16_t min_extra_isize;
+  uint16_t want_extra_isize;
+  uint32_t flags;
   // other fields ignored
 };
 
+#define INCOMPAT_64BIT 0x80
+
+// Superblock::flags
+#define FLAGS_SIGNED_HASH   1
+#define FLAGS_UNSIGNED_HASH 2
+
+// ext4 extent tree; the root node is stored in Inode::direct_blocks..indirect3_block (60 bytes)
+#define EXTENTS_FLAG 0x80000  // in Inode::flags
+#define EXTENT_MAGIC 0xf30a
+#define EXTENT_MAX_DEPTH 5
+
+struct ExtentHeader {
+  uint16_t magic;
+  uint16_t entries;
+  uint16_t max_entries;
+  uint16_t depth;  // 0 - leaf node
+  uint32_t generation;
+};
+
+struct ExtentIndex {  // entry of a non-leaf node
+  uint32_t block;     // first logical block of the subtree
+  uint32_t leaf_lo;
+  uint16_t leaf_hi;   // ignored, only 32-bit block numbers supported
+  uint16_t unused;
+};
+
+struct Extent {  // entry of a leaf node
+  uint32_t block;     // first logical block
+  uint16_t len;       // > 32768 - uninitialized extent of (len - 32768) blocks
+  uint16_t start_hi;  // ignored, only 32-bit block numbers supported
+  uint32_t start_lo;
+};
+
 struct GroupDescriptor {
   uint32_t block_usage_block;
   uint32_t inode_usage_block;
@@ -52,18 +114,66 @@ struct DirEntryHeader {
   char name[0];
 };
 
+// Hashed directory index (HTree); block 0 of the directory is DxRoot, other index blocks are DxNode.
+#define INDEX_FLAG 0x1000  // in Inode::flags
+
+#define DX_HASH_LEGACY   0
+#define DX_HASH_HALF_MD4 1
+#define DX_HASH_TEA      2
+#define DX_HASH_UNSIGNED 3  // added to the version if chars are unsigned
+#define DX_MAX_LEVELS    3
+
+struct DxEntry {
+  uint32_t hash;   // in the first entry: limit (16 bit) and count (16 bit)
+  uint32_t block;  // logical block in the directory
+};
+
+struct DxRoot {
+  char dot_and_dotdot[24];
+  uint32_t reserved_zero;
+  unsigned char hash_version;
+  unsigned char info_length;  // 8
+  unsigned char indirect_levels;
+  unsigned char unused_flags;
+  struct DxEntry entries[0];
+};
+
+struct DxNode {
+  char fake_dir_entry[8];
+  struct DxEntry entries[0];
+};
+
+// Cache of resolved path components: (parent inode, name) -> inode.
+#define DENTRY_CACHE_SIZE 128
+#define DENTRY_NAME_MAX   24  // longer names are not cached
+
+struct DentryCacheEntry {
+  uint32_t parent;
+  uint32_t inode;  // 0 - empty entry
+  char name[DENTRY_NAME_MAX];  // not null-terminated if the name length is DENTRY_NAME_MAX
+};
+
 #define BUFFER_BASE (void*)(RAM_BASE + 0x180000)
+#define BLOCK_CACHE_BASE (void*)(RAM_BASE + 0x1a0000)
+
+// LRU cache for metadata blocks (group descriptors, inode tables, indirect blocks).
+#define BLOCK_CACHE_SLOTS 16
+#define BLOCK_CACHE_SLOT_SIZE (1<<12)  // max supported block size
 
 static uint32_t partition_start = -1;
 static void *mbr_buf                 = BUFFER_BASE;
 static struct Superblock *superblock = BUFFER_BASE + 1024;
-static void *group_desc_table        = BUFFER_BASE + (1<<12);
-static void *inode_buf               = BUFFER_BASE + (2<<12);
-static uint32_t *indirect1_buf       = BUFFER_BASE + (3<<12);
-static uint32_t *indirect2_buf       = BUFFER_BASE + (4<<12);
-static uint32_t *indirect3_buf       = BUFFER_BASE + (5<<12);
-static void *dir_buf                 = BUFFER_BASE + (6<<12);
-static uint32_t inode_buf_loaded_block;
+static void *inode_buf               = BUFFER_BASE + (1<<12);
+static void *dir_buf                 = BUFFER_BASE + (2<<12);
+static struct DentryCacheEntry *dentry_cache = BUFFER_BASE + (3<<12);
+static void *block_cache             = BLOCK_CACHE_BASE;
+static uint32_t block_cache_tags[BLOCK_CACHE_SLOTS];
+static uint32_t block_cache_last_use[BLOCK_CACHE_SLOTS];
+static uint32_t block_cache_clock;
+static uint32_t block_cache_hits, block_cache_misses;
+static uint32_t group_desc_table_block;
+static uint32_t group_desc_size;
+static uint32_t dentry_cache_next;
 
 //#define DEBUG
 
@@ -85,67 +195,205 @@ static bool read_block(void* dst, uint32_t block) {
   return count == sectors;
 }
 
+static void clear_block_cache() {
+  for (int i = 0; i < BLOCK_CACHE_SLOTS; ++i) {
+    block_cache_tags[i] = -1;
+    block_cache_last_use[i] = 0;
+  }
+  block_cache_clock = 0;
+}
+
+// Returned pointer is valid until the next call (a miss evicts the least recently used slot).
+static void* get_cached_block(uint32_t block) {
+  int lru = 0;
+  for (int i = 0; i < BLOCK_CACHE_SLOTS; ++i) {
+    if (block_cache_tags[i] == block) {
+      block_cache_hits++;
+      block_cache_last_use[i] = ++block_cache_clock;
+      return block_cache + i * BLOCK_CACHE_SLOT_SIZE;
+    }
+    if (block_cache_last_use[i] < block_cache_last_use[lru]) lru = i;
+  }
+  block_cache_misses++;
+  void* buf = block_cache + lru * BLOCK_CACHE_SLOT_SIZE;
+  if (!read_block(buf, block)) {
+    block_cache_tags[lru] = -1;
+    block_cache_last_use[lru] = 0;
+    return 0;
+  }
+  block_cache_tags[lru] = block;
+  block_cache_last_use[lru] = ++block_cache_clock;
+  return buf;
+}
+
+void print_ext2_cache_stats() {
+  printf("Block cache: %u hits, %u misses (%u slots)\n", block_cache_hits, block_cache_misses, BLOCK_CACHE_SLOTS);
+}
+
+// Returns a copy of the inode. It is valid until the next get_inode/find_inode call.
 struct Inode* get_inode(uint32_t inode) {
   if (inode == 0) return 0;
   uint32_t group = (inode - 1) / superblock->inodes_per_group;
   uint32_t index = (inode - 1) % superblock->inodes_per_group;
-  struct GroupDescriptor* group_descr = (group_desc_table + group * 32);
+  uint32_t descr_offset = group * group_desc_size;
+  const struct GroupDescriptor* group_descr = get_cached_block(group_desc_table_block + (descr_offset >> (10 + superblock->log_block_size)));
+  if (!group_descr) return 0;
+  group_descr = (const void*)group_descr + (descr_offset & (block_size() - 1));
   uint32_t group_offset = index * superblock->inode_size;
   uint32_t block_offset = group_offset & (block_size() - 1);
   uint32_t block = group_descr->inode_table_block + (group_offset >> (10 + superblock->log_block_size));
-  if (inode_buf_loaded_block != block) {
-    if (!read_block(inode_buf, block)) {
-      inode_buf_loaded_block = -1;
-      return 0;
-    }
-    inode_buf_loaded_block = block;
-  }
-  return inode_buf + block_offset;
+  const uint32_t* src = get_cached_block(block);
+  if (!src) return 0;
+  src += block_offset >> 2;
+  uint32_t* dst = inode_buf;
+  for (int i = 0; i < superblock->inode_size >> 2; ++i) dst[i] = src[i];
+  return inode_buf;
 }
 
 struct BlockIterator {
   const struct Inode* inode;
-  int i0, i1, i2, i3;
+  uint32_t index;        // next logical block
+  uint32_t end;          // number of logical blocks in the file
+  // block map
+  uint32_t ind1_id;      // index of the loaded indirect1 table in the file, -1 if not loaded
+  const uint32_t* ind1;  // points to the block cache, 0 if the table is absent (hole)
+  // extent tree
+  uint32_t ext_block, ext_len, ext_start;  // the loaded extent
 };
 
 static bool start_block_iter(const struct Inode* inode, struct BlockIterator* iter) {
   iter->inode = inode;
-  iter->i0 = iter->i1 = iter->i2 = iter->i3 = 0;
-  if (iter->inode->indirect1_block && !read_block(indirect1_buf, iter->inode->indirect1_block)) return 0;
-  if (iter->inode->indirect2_block && !read_block(indirect2_buf, iter->inode->indirect2_block)) return 0;
-  if (iter->inode->indirect3_block && !read_block(indirect3_buf, iter->inode->indirect3_block)) return 0;
+  iter->index = 0;
+  iter->end = (inode->size_lo + block_size() - 1) >> (10 + superblock->log_block_size);
+  iter->ind1_id = -1;
+  iter->ind1 = 0;
+  iter->ext_len = 0;
   return 1;
 }
 
-static uint32_t next_block(struct BlockIterator* iter) {
-  uint32_t max_i = 256 << superblock->log_block_size;
-  while (1) {
-    if (iter->i0 < 12) {
-      uint32_t block = iter->inode->direct_blocks[iter->i0++];
-      if (block)
-        return block;
-      else
-        continue;
+// Loads the first extent that ends after logical block `index`. Returns 1 on success, 0 if there is no such extent
+// (the rest of the file is a hole), -1 in case of IO error or a damaged tree.
+static int load_extent(struct BlockIterator* iter, uint32_t index) {
+  const struct ExtentHeader* h = (const void*)iter->inode->direct_blocks;
+  uint32_t next_subtree = -1;  // first logical block of the next subtree at the deepest visited level
+  int level = 0;
+  while (h->magic == EXTENT_MAGIC && level++ <= EXTENT_MAX_DEPTH) {
+    if (h->depth > 0 && h->entries) {
+      const struct ExtentIndex* e = (const void*)(h + 1);
+      int k = 0;
+      while (k + 1 < h->entries && e[k + 1].block <= index) k++;
+      if (k + 1 < h->entries) next_subtree = e[k + 1].block;
+      h = get_cached_block(e[k].leaf_lo);
+      if (!h) return -1;
+      continue;
     }
-    if (iter->inode->indirect1_block && iter->i1 < max_i) {
-      uint32_t block = indirect1_buf[iter->i1++];
-      if (block)
-        return block;
-      else
-        continue;
+    const struct Extent* e = (const void*)(h + 1);
+    for (int k = 0; k < h->entries; ++k) {
+      uint32_t len = e[k].len <= 32768 ? e[k].len : 0;  // uninitialized extents are skipped
+      if (len && e[k].block + len > index) {
+        iter->ext_block = e[k].block;
+        iter->ext_len = len;
+        iter->ext_start = e[k].start_lo;
+        return 1;
+      }
     }
-    if (iter->inode->indirect2_block && iter->i2 < max_i) {
-      if (!read_block(indirect1_buf, indirect2_buf[iter->i2++])) return 0;
-      iter->i1 = 0;
-      continue;
+    if (next_subtree == -1) return 0;
+    index = next_subtree;  // the rest of the leaf is a hole, continue from the next subtree
+    next_subtree = -1;
+    level = 0;
+    h = (const void*)iter->inode->direct_blocks;
+  }
+  return -1;
+}
+
+static uint32_t next_extent_block(struct BlockIterator* iter) {
+  while (iter->index < iter->end) {
+    if (iter->index - iter->ext_block < iter->ext_len) {
+      return iter->ext_start + (iter->index++ - iter->ext_block);
     }
-    if (iter->inode->indirect3_block && iter->i3 < max_i) {
-      if (!read_block(indirect2_buf, indirect3_buf[iter->i3++])) return 0;
-      iter->i2 = 0;
-      continue;
+    int res = load_extent(iter, iter->index);
+    if (res <= 0) {
+      if (res == 0) iter->index = iter->end;  // the rest of the file is a hole
+      return 0;
     }
-    return 0;
+    if (iter->index < iter->ext_block) iter->index = iter->ext_block;  // skip hole
   }
+  return 0;
+}
+
+// Returns entry `index` of the indirect block `block`, or 0 if the block is absent.
+static uint32_t indirect_entry(uint32_t block, uint32_t index) {
+  if (!block) return 0;
+  const uint32_t* data = get_cached_block(block);
+  return data ? data[index] : 0;
+}
+
+// Indirect blocks are loaded lazily through the block cache. Between the calls only `iter->ind1`
+// is kept, and it is always the most recently used cache slot.
+// Holes are skipped. Returns 0 at the end of the file or in case of IO error; only after an error
+// `iter->index < iter->end`.
+static uint32_t next_block(struct BlockIterator* iter) {
+  if (iter->inode->flags & EXTENTS_FLAG) return next_extent_block(iter);
+  uint32_t bits = 8 + superblock->log_block_size;  // log2(entries per indirect block)
+  uint32_t mask = (1 << bits) - 1;
+  while (iter->index < iter->end) {
+    uint32_t i = iter->index++;
+    uint32_t block;
+    if (i < 12) {
+      block = iter->inode->direct_blocks[i];
+    } else {
+      i -= 12;
+      if ((i >> bits) != iter->ind1_id) {
+        uint32_t ind1_block;
+        iter->ind1_id = i >> bits;
+        if (i < (1 << bits)) {
+          ind1_block = iter->inode->indirect1_block;
+        } else if (i < (1 << bits) + (1 << (2 * bits))) {
+          uint32_t j = i - (1 << bits);
+          ind1_block = indirect_entry(iter->inode->indirect2_block, j >> bits);
+        } else {
+          uint32_t j = i - (1 << bits) - (1 << (2 * bits));
+          ind1_block = indirect_entry(indirect_entry(iter->inode->indirect3_block, j >> (2 * bits)), (j >> bits) & mask);
+        }
+        iter->ind1 = ind1_block ? get_cached_block(ind1_block) : 0;
+        if (ind1_block && !iter->ind1) {  // IO error
+          iter->index--;
+          iter->ind1_id = -1;
+          return 0;
+        }
+      }
+      block = iter->ind1 ? iter->ind1[i & mask] : 0;
+    }
+    if (block) return block;
+  }
+  return 0;
+}
+
+// Scans dir_buf. Returns inode of the entry with the given name, or 0 if not found.
+static uint32_t scan_dir_buf(bool print, const char* search) {
+  int pos = 0;
+  while (pos < block_size()) {
+    struct DirEntryHeader* h = dir_buf + pos;
+    pos += h->entry_size;
+    if (h->inode == 0) continue;
+    if (print) {
+      putchar('*');
+      putchar(' ');
+      for (int i = 0; i < h->name_size; ++i) putchar(h->name[i]);
+      putchar('\n');
+    }
+    if (search) {
+      int i = 0;
+      while (i < h->name_size && search[i] == h->name[i]) i++;
+      if (i == h->name_size && (search[h->name_size] == 0 || search[h->name_size] == '/')) {
+#ifdef DEBUG
+        printf("read_dir return inode_id=%u\n", h->inode);
+#endif
+        return h->inode;
+      }
+    }
+  }
+  return 0;
 }
 
 static uint32_t read_dir(const struct Inode* inode, bool print, const char* search) {
@@ -157,35 +405,193 @@ static uint32_t read_dir(const struct Inode* inode, bool print, const char* sear
   if (!start_block_iter(inode, &iter)) return 0;
   while ((block = next_block(&iter))) {
     if (!read_block(dir_buf, block)) return 0;
-    int pos = 0;
-    while (pos < block_size()) {
-      struct DirEntryHeader* h = dir_buf + pos;
-      pos += h->entry_size;
-      if (h->inode == 0) continue;
-      if (print) {
-        putchar('*');
-        putchar(' ');
-        for (int i = 0; i < h->name_size; ++i) putchar(h->name[i]);
-        putchar('\n');
-      }
-      if (search) {
-        int i = 0;
-        while (i < h->name_size && search[i] == h->name[i]) i++;
-        if (i == h->name_size && (search[h->name_size] == 0 || search[h->name_size] == '/')) {
-#ifdef DEBUG
-          printf("read_dir return inode_id=%u\n", h->inode);
-#endif
-          return h->inode;
-        }
-      }
+    uint32_t res = scan_dir_buf(print, search);
+    if (res) return res;
+  }
+  return 0;
+}
+
+// *** HTree directory lookup, hash functions are the same as in linux/fs/ext4/hash.c
+
+static void str2hashbuf(const char* msg, int len, uint32_t* buf, int num, bool unsigned_chars) {
+  uint32_t pad = (uint32_t)len | ((uint32_t)len << 8);
+  pad |= pad << 16;
+  uint32_t val = pad;
+  if (len > num * 4) len = num * 4;
+  for (int i = 0; i < len; i++) {
+    int c = unsigned_chars ? (int)(unsigned char)msg[i] : (int)(signed char)msg[i];
+    val = c + (val << 8);
+    if ((i % 4) == 3) {
+      *buf++ = val;
+      val = pad;
+      num--;
     }
   }
+  if (--num >= 0) *buf++ = val;
+  while (--num >= 0) *buf++ = pad;
+}
+
+static void tea_transform(uint32_t buf[4], const uint32_t in[4]) {
+  uint32_t sum = 0;
+  uint32_t b0 = buf[0], b1 = buf[1];
+  for (int n = 0; n < 16; ++n) {
+    sum += 0x9e3779b9;
+    b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+    b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+  }
+  buf[0] += b0;
+  buf[1] += b1;
+}
+
+static uint32_t rol32(uint32_t x, int s) { return (x << s) | (x >> (32 - s)); }
+
+static void half_md4_transform(uint32_t buf[4], const uint32_t in[8]) {
+  static const unsigned char order[24] = {0, 1, 2, 3, 4, 5, 6, 7,  1, 3, 5, 7, 0, 2, 4, 6,  3, 7, 2, 6, 1, 5, 0, 4};
+  static const unsigned char shifts[12] = {3, 7, 11, 19,  3, 5, 9, 13,  3, 9, 11, 15};
+  static const uint32_t k[3] = {0, 013240474631, 015666365641};
+  uint32_t v[4] = {buf[0], buf[1], buf[2], buf[3]};  // a, b, c, d
+  for (int i = 0; i < 24; ++i) {
+    int round = i >> 3;
+    uint32_t a = v[(4 - i) & 3], b = v[(5 - i) & 3], c = v[(6 - i) & 3], d = v[(7 - i) & 3];
+    uint32_t f;
+    if (round == 0)
+      f = d ^ (b & (c ^ d));
+    else if (round == 1)
+      f = (b & c) + ((b ^ c) & d);
+    else
+      f = b ^ c ^ d;
+    v[(4 - i) & 3] = rol32(a + f + in[order[i]] + k[round], shifts[(round << 2) | (i & 3)]);
+  }
+  for (int i = 0; i < 4; ++i) buf[i] += v[i];
+}
+
+static uint32_t dx_hash(const char* name, int len, int version) {
+  bool unsigned_chars = version >= DX_HASH_UNSIGNED;
+  if (unsigned_chars) version -= DX_HASH_UNSIGNED;
+  uint32_t buf[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+  const uint32_t* seed = superblock->hash_seed;
+  if (seed[0] | seed[1] | seed[2] | seed[3]) {
+    for (int i = 0; i < 4; ++i) buf[i] = seed[i];
+  }
+  uint32_t in[8];
+  uint32_t hash;
+  if (version == DX_HASH_LEGACY) {
+    uint32_t hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+    for (int i = 0; i < len; ++i) {
+      int c = unsigned_chars ? (int)(unsigned char)name[i] : (int)(signed char)name[i];
+      hash = hash1 + (hash0 ^ (c * 7152373));
+      if (hash & 0x80000000) hash -= 0x7fffffff;
+      hash1 = hash0;
+      hash0 = hash;
+    }
+    hash = hash0 << 1;
+  } else if (version == DX_HASH_HALF_MD4) {
+    for (; len > 0; len -= 32, name += 32) {
+      str2hashbuf(name, len, in, 8, unsigned_chars);
+      half_md4_transform(buf, in);
+    }
+    hash = buf[1];
+  } else {
+    for (; len > 0; len -= 16, name += 16) {
+      str2hashbuf(name, len, in, 4, unsigned_chars);
+      tea_transform(buf, in);
+    }
+    hash = buf[0];
+  }
+  hash &= ~1;
+  if (hash == 0xfffffffe) hash = 0xfffffffc;
+  return hash;
+}
+
+// Returns index of the entry that covers `hash`, or -1 if the node is invalid.
+static int dx_find_entry(const struct DxEntry* entries, uint32_t hash, uint32_t limit) {
+  uint32_t count = entries[0].hash >> 16;
+  if (count == 0 || count > limit) return -1;
+  int k = 0;
+  while (k + 1 < count && entries[k + 1].hash <= hash) k++;
+  return k;
+}
+
+// Looks up `name` (terminated by '/' or 0) using HTree index.
+// Returns inode id, 0 if not found, or -1 if the index can not be used.
+// next_block can load extent tree nodes through the block cache, so index nodes are fetched again after it
+// instead of keeping pointers into the cache.
+static uint32_t dx_lookup(const struct Inode* inode, const char* name, int len) {
+  struct BlockIterator iter;
+  if (!start_block_iter(inode, &iter)) return -1;
+  uint32_t node_block = next_block(&iter);  // logical block 0
+  const struct DxRoot* root = node_block ? get_cached_block(node_block) : 0;
+  if (!root || root->reserved_zero != 0 || root->info_length != 8 || root->indirect_levels >= DX_MAX_LEVELS
+      || root->hash_version > DX_HASH_TEA) return -1;
+  int version = root->hash_version;
+  if ((superblock->flags & FLAGS_UNSIGNED_HASH) || !(superblock->flags & FLAGS_SIGNED_HASH)) version += DX_HASH_UNSIGNED;
+  uint32_t hash = dx_hash(name, len, version);
+  int levels = root->indirect_levels;
+  uint32_t entries_offset = sizeof(struct DxRoot);
+  uint32_t block;
+  int k;
+  while (1) {
+    const struct DxEntry* entries = get_cached_block(node_block);
+    if (!entries) return -1;
+    entries = (const void*)entries + entries_offset;
+    k = dx_find_entry(entries, hash, (block_size() - entries_offset) / sizeof(struct DxEntry));
+    if (k < 0) return -1;
+    iter.index = entries[k].block & 0x0fffffff;
+    block = next_block(&iter);
+    if (!block) return -1;
+    if (levels-- == 0) break;
+    node_block = block;
+    entries_offset = sizeof(struct DxNode);
+  }
+  while (1) {
+    if (!read_block(dir_buf, block)) return 0;
+    uint32_t res = scan_dir_buf(0, name);
+    if (res) return res;
+    const struct DxEntry* entries = get_cached_block(node_block);
+    if (!entries) return 0;
+    entries = (const void*)entries + entries_offset;
+    // Entries with the same hash can continue in the next leaf; it is marked by the lowest bit of its hash.
+    // If the run goes on in the next index node (not the root), the linear scan is used instead.
+    if (++k >= (entries[0].hash >> 16)) return entries_offset == sizeof(struct DxRoot) ? 0 : -1;
+    if ((entries[k].hash & 1) == 0 || (entries[k].hash & ~1) != hash) return 0;
+    iter.index = entries[k].block & 0x0fffffff;
+    block = next_block(&iter);
+    if (!block) return 0;
+  }
+}
+
+static void clear_dentry_cache() {
+  for (int i = 0; i < DENTRY_CACHE_SIZE; ++i) dentry_cache[i].inode = 0;
+  dentry_cache_next = 0;
+}
+
+static uint32_t dentry_cache_lookup(uint32_t parent, const char* name, int len) {
+  if (len > DENTRY_NAME_MAX) return 0;
+  for (int i = 0; i < DENTRY_CACHE_SIZE; ++i) {
+    const struct DentryCacheEntry* e = dentry_cache + i;
+    if (e->inode == 0 || e->parent != parent) continue;
+    int j = 0;
+    while (j < len && e->name[j] == name[j]) j++;
+    if (j == len && (len == DENTRY_NAME_MAX || e->name[len] == 0)) return e->inode;
+  }
   return 0;
 }
 
+static void dentry_cache_add(uint32_t parent, const char* name, int len, uint32_t inode) {
+  if (len > DENTRY_NAME_MAX) return;
+  struct DentryCacheEntry* e = dentry_cache + dentry_cache_next;
+  dentry_cache_next = (dentry_cache_next + 1) % DENTRY_CACHE_SIZE;
+  e->parent = parent;
+  e->inode = inode;
+  for (int i = 0; i < DENTRY_NAME_MAX; ++i) e->name[i] = i < len ? name[i] : 0;
+}
+
 #define ROOT_INODE 2
 
-struct Inode* find_inode(const char* path) {
+// Returns the inode id of the file, or 0 if not found. `parent_id` is set to the directory containing the last
+// path component.
+static uint32_t lookup_path(const char* path, uint32_t* parent_id) {
+  *parent_id = 0;
   if (!is_ext2_reader_initialized()) return 0;
 #ifdef DEBUG
   printf("find_inode('%s')\n", path);
@@ -193,46 +599,326 @@ struct Inode* find_inode(const char* path) {
   if (*path == '/') path++;
   uint32_t inode_id = ROOT_INODE;
   while (inode_id && *path != 0) {
-    struct Inode* inode = get_inode(inode_id);
+    int len = 0;
+    while (path[len] != 0 && path[len] != '/') len++;
+    *parent_id = inode_id;
+    inode_id = dentry_cache_lookup(*parent_id, path, len);
+    if (!inode_id) {
+      struct Inode* inode = get_inode(*parent_id);
 #ifdef DEBUG
-    printf("find_inode id=%u => ptr=%08x\n", inode_id, inode);
+      printf("find_inode id=%u => ptr=%08x\n", *parent_id, inode);
 #endif
-    if (!inode) return 0;
-    inode_id = read_dir(inode, 0, path);
-    while (*path != 0 && *path != '/') path++;
+      if (!inode) return 0;
+      inode_id = (inode->flags & INDEX_FLAG) ? dx_lookup(inode, path, len) : -1;
+      if (inode_id == -1) inode_id = read_dir(inode, 0, path);
+      if (inode_id) dentry_cache_add(*parent_id, path, len, inode_id);
+    }
+    path += len;
     if (*path == '/') path++;
   }
 #ifdef DEBUG
   printf("find_inode return id=%u\n", inode_id);
 #endif
-  return get_inode(inode_id);
+  return inode_id;
+}
+
+struct Inode* find_inode(const char* path) {
+  uint32_t parent_id;
+  return get_inode(lookup_path(path, &parent_id));
 }
 
 void print_dir(const struct Inode* inode) {
   read_dir(inode, 1, 0);
 }
 
-uint32_t read_file(const struct Inode* inode, void* dst, uint32_t max_size) {
-  struct BlockIterator iter;
+// Physically contiguous blocks are merged and read with a single sdread (one CMD18).
+// Long runs are split to limit the time between the checks of the SD card state.
+#define MAX_READ_RUN_SECTORS 4096  // 2 MB
+
+// Reads up to `max_size` bytes starting from the current position of the iterator. `max_size` is
+// rounded up to whole sectors, so `dst` should have space for that.
+static uint32_t read_blocks(struct BlockIterator* iter, void* dst, uint32_t max_size) {
   uint32_t block;
   uint32_t size_done = 0;
-  if (!start_block_iter(inode, &iter)) return 0;
-  while ((block = next_block(&iter)) && size_done < max_size) {
-    uint32_t sectors = 2 << superblock->log_block_size;
-    uint32_t first_sector = block * sectors;
-    uint32_t sectors_limit = (max_size - size_done + 511) >> 9;
-    if (sectors > sectors_limit) sectors = sectors_limit;
-    if (sdread(dst, partition_start + first_sector, sectors) != sectors) return size_done;
-    dst += (sectors << 9);
-    size_done += (sectors << 9);
+  uint32_t sectors_left = (max_size + 511) >> 9;
+  uint32_t block_sectors = 2 << superblock->log_block_size;
+  uint32_t run_start = 0, run_sectors = 0;
+  while (sectors_left && (block = next_block(iter))) {
+    uint32_t first_sector = partition_start + block * block_sectors;
+    uint32_t sectors = block_sectors < sectors_left ? block_sectors : sectors_left;
+    sectors_left -= sectors;
+    if (run_sectors && first_sector == run_start + run_sectors && run_sectors + sectors <= MAX_READ_RUN_SECTORS) {
+      run_sectors += sectors;
+      continue;
+    }
+    if (run_sectors) {
+      if (sdread(dst, run_start, run_sectors) != run_sectors) return size_done;
+      dst += (run_sectors << 9);
+      size_done += (run_sectors << 9);
+    }
+    run_start = first_sector;
+    run_sectors = sectors;
+  }
+  if (run_sectors) {
+    if (sdread(dst, run_start, run_sectors) != run_sectors) return size_done;
+    size_done += (run_sectors << 9);
   }
   return size_done < max_size ? size_done : max_size;
 }
 
+uint32_t read_file(const struct Inode* inode, void* dst, uint32_t max_size) {
+  struct BlockIterator iter;
+  if (!start_block_iter(inode, &iter)) return 0;
+  return read_blocks(&iter, dst, max_size);
+}
+
+struct StreamState {
+  struct Inode inode;  // a copy, `iter.inode` points here
+  struct BlockIterator iter;
+};
+
+_Static_assert(sizeof(struct StreamState) <= sizeof(((struct FileStream*)0)->reader_state), "FileStream::reader_state is too small");
+
+int ext2_stream_open(struct FileStream* stream, const char* path, void* buf0, void* buf1, unsigned chunk_size) {
+  if (!is_ext2_reader_initialized() || chunk_size == 0 || (chunk_size & 4095)) return -1;
+  const struct Inode* inode = find_inode(path);
+  if (!inode || !is_regular_file(inode)) return -1;
+  struct StreamState* st = (struct StreamState*)stream->reader_state;
+  const uint32_t* src = (const uint32_t*)inode;
+  uint32_t* dst = (uint32_t*)&st->inode;
+  for (int i = 0; i < sizeof(struct Inode) / 4; ++i) dst[i] = src[i];
+  start_block_iter(&st->inode, &st->iter);
+  stream->file_size = st->inode.size_lo;
+  stream->offset = 0;
+  stream->chunk_size = chunk_size;
+  stream->buf[0] = buf0;
+  stream->buf[1] = buf1;
+  stream->next_buf = 0;
+  return 0;
+}
+
+int ext2_stream_next_chunk(struct FileStream* stream, void** chunk) {
+  struct StreamState* st = (struct StreamState*)stream->reader_state;
+  uint32_t size = stream->file_size - stream->offset;
+  if (size > stream->chunk_size) size = stream->chunk_size;
+  if (size == 0) return 0;
+  void* dst = stream->buf[stream->next_buf];
+  st->iter.ind1_id = -1;  // the block cache could be reused since the previous call, reload the indirect table
+  if (read_blocks(&st->iter, dst, size) != size) return -1;
+  stream->next_buf ^= 1;
+  stream->offset += size;
+  *chunk = dst;
+  return size;
+}
+
+// *** Boot catalog
+//
+// Caches inode numbers and physical block runs of the files loaded by the boot script, so the next boot reads
+// them without walking directories, indirect blocks and extent trees. The catalog is stored in a preallocated
+// file (e.g. `dd if=/dev/zero of=/boot.cat bs=4K count=4`); BIOS rewrites its content in place, but never
+// allocates blocks. An entry is used only if the path still resolves to the same inode and the inode (mtime,
+// ctime, size) and the parent directory (mtime) are unchanged, otherwise the entry is rebuilt.
+
+#define BOOT_CATALOG_MAGIC 0x54414342  // "BCAT"
+#define BOOT_CATALOG_MAX_SIZE (16<<10)
+#define BOOT_CATALOG_PATH_MAX 64
+
+struct BootCatalogHeader {
+  uint32_t magic;
+  uint32_t fs_id;      // first word of the fs UUID
+  uint32_t used_size;  // including the header
+  uint32_t reserved;
+};
+
+struct BlockRun {
+  uint32_t start;
+  uint32_t count;
+};
+
+struct BootCatalogEntry {
+  uint32_t entry_size;  // including runs
+  uint32_t inode_id, mtime, ctime, size;
+  uint32_t parent_id, parent_mtime;
+  uint32_t run_count;
+  char path[BOOT_CATALOG_PATH_MAX];  // without leading '/'
+  struct BlockRun runs[];
+};
+
+static struct BootCatalogHeader *boot_catalog = BUFFER_BASE + (4<<12);
+static uint32_t boot_catalog_inode;  // 0 if the catalog is not opened
+static uint32_t boot_catalog_capacity;
+
+static uint32_t fs_id() { return *(uint32_t*)superblock->uuid; }
+
+// The catalog is read from disk and can be damaged, so the entries are checked once when it is opened.
+static bool boot_catalog_valid(uint32_t capacity) {
+  if (boot_catalog->magic != BOOT_CATALOG_MAGIC || boot_catalog->fs_id != fs_id() ||
+      boot_catalog->used_size < sizeof(struct BootCatalogHeader) || boot_catalog->used_size > capacity) {
+    return 0;
+  }
+  uint32_t offset = sizeof(struct BootCatalogHeader);
+  while (offset < boot_catalog->used_size) {
+    const struct BootCatalogEntry* e = (void*)boot_catalog + offset;
+    uint32_t left = boot_catalog->used_size - offset;
+    if (left < sizeof(struct BootCatalogEntry) || e->entry_size > left ||
+        e->run_count > (left - sizeof(struct BootCatalogEntry)) / sizeof(struct BlockRun) ||
+        e->entry_size != sizeof(struct BootCatalogEntry) + e->run_count * sizeof(struct BlockRun) ||
+        e->path[BOOT_CATALOG_PATH_MAX - 1] != 0) {
+      return 0;
+    }
+    offset += e->entry_size;
+  }
+  return 1;
+}
+
+void open_boot_catalog(const char* path) {
+  uint32_t parent_id;
+  uint32_t inode_id = lookup_path(path, &parent_id);
+  const struct Inode* inode = get_inode(inode_id);
+  boot_catalog_inode = 0;
+  if (!inode || !is_regular_file(inode)) return;
+  uint32_t capacity = inode->size_lo & ~(block_size() - 1);
+  if (capacity > BOOT_CATALOG_MAX_SIZE) capacity = BOOT_CATALOG_MAX_SIZE;
+  // sparse files are not supported because the catalog is updated in place
+  if (capacity == 0 || inode->sector_count < (capacity >> 9)) return;
+  if (read_file(inode, boot_catalog, capacity) != capacity) return;
+  if (!boot_catalog_valid(capacity)) {
+    boot_catalog->magic = BOOT_CATALOG_MAGIC;
+    boot_catalog->fs_id = fs_id();
+    boot_catalog->used_size = sizeof(struct BootCatalogHeader);
+  }
+  boot_catalog_inode = inode_id;
+  boot_catalog_capacity = capacity;
+}
+
+void close_boot_catalog() { boot_catalog_inode = 0; }
+
+static void write_boot_catalog() {
+  struct BlockIterator iter;
+  uint32_t block_sectors = 2 << superblock->log_block_size;
+  const struct Inode* inode = get_inode(boot_catalog_inode);
+  if (!inode || !start_block_iter(inode, &iter)) {
+    printf("Boot catalog update failed\n");
+    boot_catalog_inode = 0;
+    return;
+  }
+  for (uint32_t offset = 0; offset < boot_catalog->used_size; offset += block_size()) {
+    uint32_t block = next_block(&iter);
+    if (!block || sdwrite((void*)boot_catalog + offset, partition_start + block * block_sectors, block_sectors) != block_sectors) {
+      printf("Boot catalog update failed\n");
+      boot_catalog_inode = 0;
+      return;
+    }
+  }
+}
+
+static struct BootCatalogEntry* boot_catalog_find(const char* path) {
+  void* end = (void*)boot_catalog + boot_catalog->used_size;
+  struct BootCatalogEntry* e = (void*)(boot_catalog + 1);
+  for (; (void*)e < end; e = (void*)e + e->entry_size) {
+    if (strcmp(e->path, path) == 0) return e;
+  }
+  return 0;
+}
+
+// Any directory on the path could be renamed or replaced, so the path is resolved again (directories only, the
+// file's block map is not walked) and must lead to the same inode.
+static bool boot_catalog_entry_valid(const struct BootCatalogEntry* e) {
+  uint32_t parent_id;
+  if (lookup_path(e->path, &parent_id) != e->inode_id || parent_id != e->parent_id) return 0;
+  const struct Inode* inode = get_inode(e->parent_id);
+  if (!inode || inode->mtime != e->parent_mtime) return 0;
+  inode = get_inode(e->inode_id);
+  return inode && inode->link_count && is_regular_file(inode) &&
+         inode->mtime == e->mtime && inode->ctime == e->ctime && inode->size_lo == e->size;
+}
+
+// Resolves the file and appends a new entry. Returns 0 if the file is not found or the entry doesn't fit.
+static struct BootCatalogEntry* boot_catalog_add(const char* path, struct BootCatalogEntry* outdated) {
+  if (outdated) {
+    uint32_t* dst = (uint32_t*)outdated;
+    uint32_t* src = (void*)outdated + outdated->entry_size;
+    uint32_t* end = (void*)boot_catalog + boot_catalog->used_size;
+    boot_catalog->used_size -= outdated->entry_size;
+    while (src < end) *dst++ = *src++;
+  }
+  struct BootCatalogEntry* e = (void*)boot_catalog + boot_catalog->used_size;
+  void* catalog_end = (void*)boot_catalog + boot_catalog_capacity;
+  uint32_t parent_id;
+  uint32_t inode_id = lookup_path(path, &parent_id);
+  const struct Inode* inode = get_inode(parent_id);
+  struct BlockIterator iter;
+  if (!inode_id || !inode || (void*)e->runs > catalog_end) goto failed;
+  e->parent_id = parent_id;
+  e->parent_mtime = inode->mtime;
+  inode = get_inode(inode_id);
+  if (!inode || !is_regular_file(inode)) goto failed;
+  e->inode_id = inode_id;
+  e->mtime = inode->mtime;
+  e->ctime = inode->ctime;
+  e->size = inode->size_lo;
+  for (int i = 0; i < BOOT_CATALOG_PATH_MAX; ++i) e->path[i] = 0;
+  for (int i = 0; path[i]; ++i) e->path[i] = path[i];
+  struct BlockRun* run = e->runs - 1;
+  uint32_t block, blocks = 0;  // logical blocks covered by the runs
+  bool hole = 0;
+  start_block_iter(inode, &iter);
+  while ((block = next_block(&iter))) {
+    // Runs can't describe a hole; the entry covers the blocks before it, and boot_catalog_read leaves such
+    // files to the regular reader.
+    if (iter.index - 1 != blocks++) {
+      hole = 1;
+      break;
+    }
+    if (run >= e->runs && block == run->start + run->count) {
+      run->count++;
+      continue;
+    }
+    if ((void*)(++run + 1) > catalog_end) goto failed;
+    run->start = block;
+    run->count = 1;
+  }
+  if (!hole && iter.index < iter.end) goto failed;  // IO error
+  e->run_count = run + 1 - e->runs;
+  e->entry_size = (void*)(run + 1) - (void*)e;
+  boot_catalog->used_size += e->entry_size;
+  write_boot_catalog();
+  return e;
+failed:
+  if (outdated) write_boot_catalog();
+  return 0;
+}
+
+int boot_catalog_read(const char* path, void* dst, uint32_t max_size) {
+  if (!boot_catalog_inode) return -1;
+  if (*path == '/') path++;
+  if (strlen(path) >= BOOT_CATALOG_PATH_MAX) return -1;
+  struct BootCatalogEntry* e = boot_catalog_find(path);
+  if (!e || !boot_catalog_entry_valid(e)) e = boot_catalog_add(path, e);
+  if (!e || e->size > max_size) return -1;
+  uint32_t block_sectors = 2 << superblock->log_block_size;
+  uint32_t sectors_left = (e->size + 511) >> 9;
+  for (int i = 0; i < e->run_count && sectors_left; ++i) {
+    uint32_t sector = partition_start + e->runs[i].start * block_sectors;
+    uint32_t sectors = e->runs[i].count * block_sectors;
+    if (sectors > sectors_left) sectors = sectors_left;
+    sectors_left -= sectors;
+    while (sectors) {
+      uint32_t count = sectors < MAX_READ_RUN_SECTORS ? sectors : MAX_READ_RUN_SECTORS;
+      if (sdread(dst, sector, count) != count) return -1;
+      dst += count << 9;
+      sector += count;
+      sectors -= count;
+    }
+  }
+  return sectors_left ? -1 : e->size;
+}
+
 bool is_ext2_reader_initialized() { return partition_start != -1; }
 
 static const char* init_ext2_reader(unsigned start_sector) {
   partition_start = -1;
+  boot_catalog_inode = 0;
   if (get_sdcard_sector_count() < start_sector + 4) {
     return "No SD card or invalid start sector";
   }
@@ -242,13 +928,15 @@ static const char* init_ext2_reader(unsigned start_sector) {
   if (superblock->ext2_signature != 0xef53) {
     return "No EXT2 signature";
   }
+  if (superblock->log_block_size > 2) {
+    return "Block size > 4KB not supported";
+  }
   partition_start = start_sector;
   if (superblock->version_major == 0) superblock->inode_size = 128;
-  inode_buf_loaded_block = -1;
-  if (!read_block(group_desc_table, superblock->log_block_size ? 1 : 2)) {
-    partition_start = -1;
-    return "IO error";
-  }
+  clear_block_cache();
+  clear_dentry_cache();
+  group_desc_table_block = superblock->log_block_size ? 1 : 2;
+  group_desc_size = (superblock->feature_incompat & INCOMPAT_64BIT) ? superblock->group_desc_size : 32;
   struct Inode* root_inode = get_inode(ROOT_INODE);
   if (!root_inode || !is_dir(root_inode)) {
     partition_start = -1;
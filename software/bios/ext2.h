@@ -43,4 +43,18 @@ struct Inode* find_inode(const char* path);
 void print_dir(const struct Inode* inode);
 uint32_t read_file(const struct Inode* inode, void* dst, uint32_t max_size);
 
+// chunk_size must be a multiple of 4096; returns -1 if the file is not found
+int ext2_stream_open(struct FileStream* stream, const char* path, void* buf0, void* buf1, unsigned chunk_size);
+// returns chunk size, 0 at the end of file, -1 in case of IO error
+int ext2_stream_next_chunk(struct FileStream* stream, void** chunk);
+
+void print_ext2_cache_stats();
+
+// Boot catalog caches block lists of the files loaded during autoboot (see ext2.c)
+void open_boot_catalog(const char* path);  // does nothing if the catalog file doesn't exist
+void close_boot_catalog();
+// Reads the file using the catalog and adds/rebuilds its entry if needed. Returns file size, or -1 if the catalog
+// is not opened or can't be used for this file.
+int boot_catalog_read(const char* path, void* dst, uint32_t max_size);
+
 #endif  // ENDEAVOUR_EXT2
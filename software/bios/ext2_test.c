@@ -0,0 +1,205 @@
+// Host test of the ext2 reader (see ext2_test.sh). ext2.c is compiled for the host with its buffers mapped at
+// RAM_BASE, SD card reads come from a filesystem image. Every regular file under SRC_DIR is read with read_file
+// and compared with the original; data reads of a file must be coalesced into as few sdread calls as possible.
+// If CATALOG is given, files under SRC_DIR/boot are also read twice through the boot catalog stored in that file:
+// the first pass may rebuild entries, the second one must not write anything. Updates of the catalog are saved
+// to IMAGE. Sparse files are not compared: read_file doesn't support holes, and the catalog must refuse them.
+//
+// Usage: ext2_test IMAGE SRC_DIR [CATALOG]
+
+#define _GNU_SOURCE
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <endeavour2/raw/defs.h>
+#include <endeavour2/raw/bios_defs.h>
+#include "ext2.h"
+
+#define MAX_READ_RUN_SECTORS 4096  // the same as in ext2.c
+
+static unsigned char* image;
+static unsigned image_sectors;
+
+// data reads of the current file: [dst_begin, dst_end) is the destination buffer
+static void* dst_begin;
+static void* dst_end;
+static unsigned data_calls, data_sectors, meta_calls;
+static unsigned last_sector, last_count;
+static unsigned block_sectors;
+static unsigned sd_writes;
+static int errors;
+
+static void fail(const char* path, const char* msg) {
+  printf("FAIL %s: %s\n", path, msg);
+  errors++;
+}
+
+unsigned get_sdcard_sector_count() { return image_sectors; }
+
+unsigned sdread(unsigned* dst, unsigned sector, unsigned sector_count) {
+  if (sector + sector_count > image_sectors) return 0;
+  memcpy(dst, image + sector * 512ull, sector_count * 512ull);
+  if ((void*)dst < dst_begin || (void*)dst >= dst_end) {
+    meta_calls++;
+    return sector_count;
+  }
+  // The first block of this read could have been appended to the previous one.
+  unsigned first = sector_count < block_sectors ? sector_count : block_sectors;
+  if (data_calls && sector == last_sector + last_count && last_count + first <= MAX_READ_RUN_SECTORS) {
+    printf("\tsdread(%u, %u) continues sdread(%u, %u)\n", sector, sector_count, last_sector, last_count);
+    errors++;
+  }
+  data_calls++;
+  data_sectors += sector_count;
+  last_sector = sector;
+  last_count = sector_count;
+  return sector_count;
+}
+
+unsigned sdwrite(const unsigned* src, unsigned sector, unsigned sector_count) {
+  if (sector + sector_count > image_sectors) return 0;
+  sd_writes++;
+  memcpy(image + sector * 512ull, src, sector_count * 512ull);
+  return sector_count;
+}
+
+static void* load(const char* path, unsigned* size) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return 0;
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  void* data = malloc(*size + 1);
+  if (fread(data, 1, *size, f) != *size) {
+    free(data);
+    data = 0;
+  }
+  fclose(f);
+  return data;
+}
+
+static size_t src_dir_len;
+static unsigned file_count, total_calls, total_sectors, total_meta_calls;
+
+static int is_sparse(const struct stat* st) { return st->st_blocks * 512 < st->st_size; }
+
+static int check_file(const char* src_path, const struct stat* st, int type, struct FTW* ftw) {
+  if (type != FTW_F || is_sparse(st)) return 0;
+  const char* path = src_path + src_dir_len;  // starts with '/'
+  unsigned size;
+  void* expected = load(src_path, &size);
+  if (!expected) {
+    fail(path, "can't read the original");
+    return 0;
+  }
+  const struct Inode* inode = find_inode(path);
+  if (!inode || !is_regular_file(inode)) {
+    fail(path, "not found");
+  } else if (inode->size_lo != size) {
+    fail(path, "wrong size");
+  } else {
+    unsigned capacity = (size + 511) & ~511;
+    void* buf = malloc(capacity + 512);
+    dst_begin = buf;
+    dst_end = buf + capacity;
+    data_calls = data_sectors = meta_calls = 0;
+    unsigned res = read_file(inode, buf, size);
+    dst_begin = dst_end = 0;
+    if (res != size) {
+      fail(path, "read_file returned wrong size");
+    } else if (memcmp(buf, expected, size) != 0) {
+      fail(path, "wrong content");
+    } else if (data_sectors != capacity / 512) {
+      fail(path, "wrong number of sectors read");
+    }
+    free(buf);
+    file_count++;
+    total_calls += data_calls;
+    total_sectors += data_sectors;
+    total_meta_calls += meta_calls;
+  }
+  free(expected);
+  return 0;
+}
+
+static int catalog_pass;
+
+static int check_catalog_file(const char* src_path, const struct stat* st, int type, struct FTW* ftw) {
+  if (type != FTW_F) return 0;
+  const char* path = src_path + src_dir_len;
+  unsigned size;
+  void* expected = load(src_path, &size);
+  if (!expected) {
+    fail(path, "can't read the original");
+    return 0;
+  }
+  unsigned capacity = (size + 511) & ~511;
+  void* buf = malloc(capacity + 512);
+  int res = boot_catalog_read(path, buf, capacity);
+  if (is_sparse(st)) {
+    if (res >= 0) fail(path, "sparse file read through the boot catalog");
+  } else if (res < 0) {
+    fail(path, "not read through the boot catalog");
+  } else if (res != size || memcmp(buf, expected, size) != 0) {
+    fail(path, catalog_pass ? "wrong content from the boot catalog" : "wrong content from a new catalog entry");
+  }
+  free(buf);
+  free(expected);
+  return 0;
+}
+
+static void check_boot_catalog(const char* src_dir, const char* catalog) {
+  char boot_dir[4096];
+  snprintf(boot_dir, sizeof(boot_dir), "%s/boot", src_dir);
+  open_boot_catalog(catalog);
+  for (catalog_pass = 0; catalog_pass < 2; ++catalog_pass) {
+    unsigned writes = sd_writes;
+    nftw(boot_dir, check_catalog_file, 16, FTW_PHYS);
+    if (catalog_pass == 1 && sd_writes != writes) fail(catalog, "rewritten although nothing changed");
+  }
+  close_boot_catalog();
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3 && argc != 4) {
+    printf("Usage: %s IMAGE SRC_DIR [CATALOG]\n", argv[0]);
+    return 2;
+  }
+  unsigned size;
+  image = load(argv[1], &size);
+  if (!image) {
+    printf("Can't read %s\n", argv[1]);
+    return 2;
+  }
+  image_sectors = size / 512;
+  block_sectors = 2 << *(unsigned*)(image + 1024 + 24);  // Superblock::log_block_size
+  // ext2.c keeps its buffers at fixed addresses
+  if (mmap((void*)RAM_BASE, 4 << 20, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0)
+      != (void*)RAM_BASE) {
+    printf("Can't map RAM_BASE\n");
+    return 2;
+  }
+
+  if (search_and_select_ext2_fs() != 0) {
+    printf("FAIL %s: ext2 filesystem not found\n", argv[1]);
+    return 1;
+  }
+  src_dir_len = strlen(argv[2]);
+  while (src_dir_len > 1 && argv[2][src_dir_len - 1] == '/') src_dir_len--;
+  nftw(argv[2], check_file, 16, FTW_PHYS);
+  if (find_inode("/no/such/file")) fail("/no/such/file", "found");
+  if (argc == 4) check_boot_catalog(argv[2], argv[3]);
+
+  printf("%s: %u files, %u sectors in %u data reads, %u metadata reads\n", argv[1], file_count, total_sectors,
+         total_calls, total_meta_calls);
+  print_ext2_cache_stats();
+  if (file_count == 0) fail(argv[2], "no files");
+  if (sd_writes) {
+    FILE* f = fopen(argv[1], "r+b");
+    if (!f || fwrite(image, 512, image_sectors, f) != image_sectors) fail(argv[1], "can't save the image");
+    if (f) fclose(f);
+  }
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,71 @@
+#!/bin/sh
+# Host test of the ext2 reader: builds filesystem images with mke2fs (e2fsprogs) and checks that ext2_test reads
+# the same files back. Run with `make test`.
+set -e
+
+TEST=$(realpath ./ext2_test)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+cd "$TMP"
+
+rnd() { head -c "$2" /dev/urandom > "$1"; }
+
+mkdir -p src/boot src/dir/sub src/many src/filler
+rnd src/empty 0
+rnd src/boot/small 100
+rnd src/boot/one_sector 512
+rnd src/boot/direct 12288                # 12 direct blocks of 1K
+rnd src/boot/indirect1 200000            # indirect block (1K blocks)
+rnd src/boot/indirect2 600000            # double indirect block (1K blocks)
+rnd src/boot/big 5000000                 # longer than one sdread run (2 MB)
+rnd src/dir/sub/with_a_long_file_name_that_is_not_cached 3000
+for i in $(seq 0 299); do rnd src/many/file$i $((i * 37)); done  # an HTree directory after `e2fsck -D`
+for i in $(seq 0 599); do rnd src/filler/f$i 1024; done
+
+echo "ext2, 1K blocks"
+mke2fs -q -F -t ext2 -b 1024 -d src ext2_1k.img 32M > /dev/null
+timeout 60 "$TEST" ext2_1k.img src
+
+# Boot catalog. Then /boot is replaced by a new directory with a new kernel, the old one stays as /boot.old;
+# catalog entries of the old files must not be used.
+echo "ext2, boot catalog"
+rnd cat 16384
+debugfs -w -R "write cat /boot.cat" ext2_1k.img > /dev/null 2>&1
+timeout 60 "$TEST" ext2_1k.img src /boot.cat
+# A damaged entry (run_count of the first entry at offset 16 + 28 is cleared) resets the catalog.
+CAT_BLOCK=$(debugfs -R "bmap /boot.cat 0" ext2_1k.img 2>/dev/null)
+printf '\0\0\0\0' | dd of=ext2_1k.img bs=1 seek=$((CAT_BLOCK * 1024 + 44)) conv=notrunc 2>/dev/null
+timeout 60 "$TEST" ext2_1k.img src /boot.cat
+rnd new_small 100
+printf "ln /boot /boot.old\nunlink /boot\nmkdir /boot\nwrite new_small /boot/small\n" > cmds
+debugfs -w -f cmds ext2_1k.img > /dev/null 2>&1
+mv src/boot src/boot.old
+mkdir src/boot
+cp new_small src/boot/small
+timeout 60 "$TEST" ext2_1k.img src /boot.cat
+rm -r src/boot
+mv src/boot.old src/boot
+
+echo "ext2, 4K blocks, indexed directories"
+mke2fs -q -F -t ext2 -b 4096 -O dir_index -d src ext2_4k.img 32M > /dev/null
+e2fsck -fyD ext2_4k.img > /dev/null 2>&1 || [ $? -eq 1 ]
+timeout 60 "$TEST" ext2_4k.img src
+
+# ext4 with 64-bit group descriptors. Few inodes per group, so files are spread over several groups.
+# /frag is written after deleting every other filler file, so its extent tree gets index nodes.
+# /boot/sparse has an unallocated tail; its catalog entry must not be rebuilt on every boot.
+echo "ext4, 64bit, 1K blocks, fragmented file, boot catalog"
+mkfs.ext4 -q -F -b 1024 -O 64bit,extent,dir_index,^resize_inode -N 1536 -d src ext4.img 32M > /dev/null
+rnd src/frag 300000
+for i in $(seq 1 2 599); do echo "rm /filler/f$i"; rm src/filler/f$i; done > cmds
+rnd src/boot/sparse 5000
+truncate -s 40000 src/boot/sparse
+printf "write src/frag /frag\nwrite src/boot/sparse /boot/sparse\nwrite cat /boot.cat\n" >> cmds
+debugfs -w -f cmds ext4.img > /dev/null 2>&1
+e2fsck -fyD ext4.img > /dev/null 2>&1 || [ $? -eq 1 ]
+dumpe2fs -h ext4.img 2>/dev/null | grep -q "Group descriptor size: *64"
+debugfs -R "ex /frag" ext4.img 2>/dev/null | grep -q "^ *0/ *1 *[0-9]*/ *[2-9]"  # several leaves
+timeout 60 "$TEST" ext4.img src /boot.cat
+debugfs -R "cat /boot.cat" ext4.img 2>/dev/null | grep -aq "boot/sparse"
+
+echo "OK"
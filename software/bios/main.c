@@ -7,9 +7,10 @@
 //    0    -   32 KB    : code (see bios.lds)
 //   32 KB - 1536 KB    : tmp buffer
 //  512 KB - 1536 KB    : memory benchmark, page1
-// 1536 KB - 1564 KB    : EXT2 buffer
+// 1536 KB - 1568 KB    : EXT2 buffer
 // 1568 KB - 1572 KB    : console script buffer
 // 1572 KB - 1604 KB    : DTB buffer
+// 1664 KB - 1728 KB    : EXT2 block cache
 // 1760 KB - 1776 KB    : EPD image
 // 1776 KB - 1792 KB    : EPD old image
 // 1792 KB - 2048 KB    : display buffer, text
@@ -85,7 +86,9 @@ void autoboot() {
   }
   if (inode && is_regular_file(inode)) {
     printf("Autostarting /%s\n", conf_name);
+    open_boot_catalog("boot.cat");
     cmd_eval(conf_name);
+    close_boot_catalog();
   }
 }
 
@@ -44,6 +44,7 @@ struct sbiret sbi_handler(unsigned arg, unsigned arg2, unsigned arg3, int fn_id,
       set_seconds_since_2000(arg);
       return (struct sbiret){SBI_OK, 0};
     }
+    if (fn_id == 6) { return (struct sbiret){SBI_OK, get_sdcard_bus_mode()}; }
   }
   if (ext_id == 0x10) {
     if (fn_id == 0) return (struct sbiret){SBI_OK, 3}; // SBI spec version = 0.3
@@ -56,10 +56,67 @@ static unsigned command(unsigned cmd, unsigned arg) {
 }
 
 static unsigned rca;
+static unsigned bus_mode;  // see get_sdcard_bus_mode
 extern unsigned sdcard_sector_count;
 
 unsigned get_sdcard_rca() { return rca; }
 unsigned get_sdcard_sector_count() { return sdcard_sector_count; }
+unsigned get_sdcard_bus_mode() { return bus_mode; }
+
+#define SAMPLE_SHIFT_DEFAULT 16
+#define BUS_MODE(mhz, shift) ((mhz) | ((shift) << 16))
+
+#ifdef BASE_CLK_IS_200MHZ
+// Tuning block pattern for 4-bit bus (SD spec 4.2.4.5), as read from big endian fifo0.
+static const unsigned tuning_pattern[16] = {
+    0xff0fff00, 0xffccc3cc, 0xc33cccff, 0xfefffeef, 0xffdfffdd, 0xfffbfffb, 0xbfff7fff, 0x77f7bdef,
+    0xfff0fff0, 0x0ffccc3c, 0xcc33cccf, 0xffefffee, 0xfffdfffd, 0xdfffbfff, 0xbbfff7ff, 0xf77f7bde};
+
+// CMD19 - send tuning block. Returns 1 if the block was received correctly.
+static int check_tuning_block() {
+  SDCARD_REGS->data = 0;
+  SDCARD_REGS->cmd = SDIO_CMD | SDIO_ERR | SDIO_R1 | SDIO_MEM | 19;
+  for (int counter = 0; SDCARD_REGS->cmd & SDIO_BUSY; ++counter) {
+    if (counter > 100000) return 0;
+  }
+  if (SDCARD_REGS->cmd & SDIO_ERR) return 0;
+  int ok = 1;
+  for (int i = 0; i < 16; ++i) {
+    if (SDCARD_REGS->fifo0 != tuning_pattern[i]) ok = 0;
+  }
+  return ok;
+}
+
+// Sweeps the sample shift and returns the centre of the widest passing window, or -1 if the window is too narrow.
+// Only bits 4:2 of the sample shift are used by the PHY, so there are 8 distinct positions.
+static int tune_sample_shift(unsigned phy) {
+  const int step = 4, positions = 8, min_window = 3, attempts = 4;
+  int best_start = 0, best_len = 0, start = 0, len = 0;
+  unsigned prev_phy = SDCARD_REGS->phy;
+  phy = (phy & 0xf0ffffff) | (6<<24);  // 64 byte blocks
+  for (int p = 0; p < positions; ++p) {
+    SDCARD_REGS->phy = (phy & ~0x1f0000) | ((p * step) << 16);
+    while ((phy & 0xff) != (SDCARD_REGS->phy & 0xff));
+    int ok = 1;
+    for (int i = 0; i < attempts && ok; ++i) ok = check_tuning_block();
+    if (ok) {
+      if (len++ == 0) start = p;
+      if (len > best_len) {
+        best_start = start;
+        best_len = len;
+      }
+    } else {
+      len = 0;
+    }
+  }
+  if (best_len < min_window) {
+    SDCARD_REGS->phy = prev_phy;  // slow clock for the following mode switch
+    while ((prev_phy & 0xff) != (SDCARD_REGS->phy & 0xff));
+    return -1;
+  }
+  return (best_start + best_len / 2) * step;
+}
+#endif
 
 void init_sdcard() {
   sdcard_sector_count = 0;
@@ -150,18 +207,34 @@ void init_sdcard() {
 
   const int SDR25 = 0x020000, SDR50 = 0x040000, SDR104 = 0x080000, DDR50 = 0x100000;
 
-  phy = (phy & ~0xf1f00ff) | SECTOR_512B | SDIOCK_SHUTDN | (/*sample shift*/ 16<<16);
-  /*if (modes & SDR104) {  // for some sdcards works, for some doesn't
+  phy = (phy & ~0xf1f00ff) | SECTOR_512B | SDIOCK_SHUTDN;
+#ifdef BASE_CLK_IS_200MHZ
+  if (modes & SDR104) {
     command(SDIO_R1 | SDIO_MEM | 6, 0x80fffff3); // switch to SDR104
-    phy |= SDIOCK_SDR104;
-  } else*/ if (modes & SDR50) {
+    int shift = tune_sample_shift(phy | SDIOCK_SDR104);
+    if (shift >= 0) {
+      printf("\tSDR104, sample shift %d\n", shift);
+      phy |= SDIOCK_SDR104 | (shift << 16);
+      bus_mode = BUS_MODE(200, shift);
+      SDCARD_REGS->phy = phy;
+      while ((phy & 0xff) != (SDCARD_REGS->phy & 0xff));
+      return;
+    }
+    printf("\tSDR104 tuning failed, fallback to SDR50\n");
+  }
+#endif
+  phy |= SAMPLE_SHIFT_DEFAULT << 16;
+  if (modes & (SDR50 | SDR104)) {
     command(SDIO_R1 | SDIO_MEM | 6, 0x80fffff2); // switch to SDR50
     phy |= SDIOCK_SDR50;
+    bus_mode = BUS_MODE(100, SAMPLE_SHIFT_DEFAULT);
   } else if (modes & SDR25) {
     command(SDIO_R1 | SDIO_MEM | 6, 0x80fffff1); // switch to SDR25
     phy |= SDIOCK_SDR25;
+    bus_mode = BUS_MODE(50, SAMPLE_SHIFT_DEFAULT);
   } else {
     phy |= SDIOCK_SDR12;
+    bus_mode = BUS_MODE(25, SAMPLE_SHIFT_DEFAULT);
   }
 
   SDCARD_REGS->phy = phy;
@@ -229,6 +302,11 @@ unsigned sdread(unsigned* dst, unsigned sector, unsigned sector_count) {
 unsigned sdwrite(const unsigned* src, unsigned sector, unsigned sector_count) {
   if (sector_count == 0) return 0;
   sd_wait_ready();
+  if (sector_count > 1) {
+    // ACMD23 - number of blocks to pre-erase before the multiple block write
+    command(SDIO_R1 | 55, rca);
+    command(SDIO_R1 | 23, sector_count);
+  }
   src = send_sector(src, &SDCARD_REGS->fifo0_le);
   SDCARD_REGS->data = sector;
   SDCARD_REGS->cmd = SDIO_CMD | SDIO_ERR | SDIO_R1 | SDIO_WRITE | SDIO_ACK | SDIO_MEM | 25;
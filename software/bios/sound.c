@@ -1,6 +1,7 @@
 #include <endeavour2/raw/defs.h>
 
 #include "bios_internal.h"
+#include "ext2.h"
 
 // generated with python ', '.join(['0x%04x' % int(math.sin(x/32*math.pi/2)*0x8000) for x in range(32)])
 static const unsigned short sin_table[32] = {
@@ -70,17 +71,20 @@ struct WavHeader {
   unsigned dataSize;
 };
 
-void playWav(void* filePtr, int volume) {
-  struct WavHeader* header = (struct WavHeader*)filePtr;
+// Configures the audio output for the stream. Returns 0 if the format is not supported.
+static int start_wav(const struct WavHeader* header, int volume) {
   AUDIO_REGS->cfg = AUDIO_SAMPLE_RATE(header->sample_rate) | AUDIO_VOLUME(volume);
   int points = header->dataSize / header->bytes_all_channels;
   printf("channels=%u rate=%u bits=%u duration=%us\n", header->num_channels, header->sample_rate, header->bits_per_sample, points / header->sample_rate);
   if (header->bits_per_sample != 16 || (header->num_channels != 1 && header->num_channels != 2)) {
     printf("Error: only 16-bit mono/stereo stream supported\n");
-    return;
+    return 0;
   }
-  int stereo = header->num_channels == 2;
-  void* data = filePtr + sizeof(struct WavHeader);
+  return 1;
+}
+
+// Returns 1 if interrupted by a key press.
+static int play_samples(const void* data, int points, int stereo) {
   for (int i = 0; i < points; ++i) {
     while (AUDIO_REGS->stream == 0);
     if (stereo) {
@@ -89,6 +93,36 @@ void playWav(void* filePtr, int volume) {
       unsigned v = ((unsigned short*)data)[i];
       AUDIO_REGS->stream = v | (v << 16);
     }
-    if ((GPIO_REGS->data_in & (GPIO_KEY0 | GPIO_KEY1)) || UART_REGS->rx >= 0) break;
+    if ((GPIO_REGS->data_in & (GPIO_KEY0 | GPIO_KEY1)) || UART_REGS->rx >= 0) return 1;
+  }
+  return 0;
+}
+
+void playWav(void* filePtr, int volume) {
+  struct WavHeader* header = (struct WavHeader*)filePtr;
+  if (!start_wav(header, volume)) return;
+  play_samples(filePtr + sizeof(struct WavHeader), header->dataSize / header->bytes_all_channels, header->num_channels == 2);
+}
+
+// Playback starts after the first chunk is read. The next chunk is read while the audio FIFO plays the tail of the
+// previous one.
+void playWavStream(struct FileStream* stream, int volume) {
+  void* data;
+  int size = ext2_stream_next_chunk(stream, &data);
+  if (size < (int)sizeof(struct WavHeader)) return;
+  const struct WavHeader* header = data;
+  if (!start_wav(header, volume)) return;
+  // the header is overwritten by the following chunks
+  int stereo = header->num_channels == 2;
+  unsigned bytes_per_point = header->bytes_all_channels;
+  unsigned data_left = header->dataSize;
+  data += sizeof(struct WavHeader);
+  size -= sizeof(struct WavHeader);
+  while (size > 0 && data_left > 0) {
+    if (size > data_left) size = data_left;
+    if (play_samples(data, size / bytes_per_point, stereo)) return;
+    data_left -= size;
+    size = ext2_stream_next_chunk(stream, &data);
   }
+  if (size < 0) printf("IO error\n");
 }
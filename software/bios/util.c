@@ -196,21 +196,21 @@ int sscanf_impl(const char* str, const char* fmt, unsigned** args) {
   return arg - args;
 }
 
-unsigned crc32(const char* data, int size) {
+static unsigned crc32_soft(unsigned crc, const char* data, int size) {
   unsigned table[16];
   for (int i = 0; i < 16; ++i) {
     unsigned c = i;
-    unsigned crc = 0;
+    unsigned t = 0;
     for (int j = 0; j < 4; ++j) {
-      int b = (c ^ crc) & 1;
-      crc >>= 1;
-      if (b) crc = crc ^ 0xedb88320;
+      int b = (c ^ t) & 1;
+      t >>= 1;
+      if (b) t = t ^ 0xedb88320;
       c >>= 1;
     }
-    table[i] = crc;
+    table[i] = t;
   }
 
-  unsigned ncrc = 0xffffffff;
+  unsigned ncrc = ~crc;
   for (int i = 0; i < size; ++i) {
     unsigned c = data[i];
     ncrc = (ncrc>>4) ^ table[(c^ncrc) & 0xf];
@@ -220,6 +220,57 @@ unsigned crc32(const char* data, int size) {
   return ~ncrc;
 }
 
+#define CRC_DMA_CHUNK 2048
+#define CRC_DMA_BATCH 8  // chunks per command list
+
+// `data` is 64-byte aligned, `chunks` <= CRC_DMA_BATCH. Chunks are read alternately to buffer bytes [0, 2048) and
+// [2048, 4096), so reading the next chunk overlaps with the CRC calculation of the current one.
+static unsigned crc32_dma(unsigned crc, const char* data, int chunks) {
+  static volatile struct DmaCmd { unsigned lo, hi; } commands[CRC_DMA_BATCH * 3] __attribute__((aligned(64)));
+  int n = 0;
+  commands[n].lo = (unsigned long)data;
+  commands[n++].hi = DMA_CMD_HI(DMA_READ_SYNC, 0, CRC_DMA_CHUNK);
+  for (int i = 0; i < chunks; ++i) {
+    unsigned b = (i & 1) * CRC_DMA_CHUNK;
+    if (i + 1 < chunks) {
+      commands[n].lo = (unsigned long)data + (i + 1) * CRC_DMA_CHUNK;
+      commands[n++].hi = DMA_CMD_HI(DMA_READ, CRC_DMA_CHUNK - b, 2*CRC_DMA_CHUNK - b);
+    }
+    commands[n].lo = 0;
+    commands[n++].hi = DMA_CMD_HI(DMA_CRC32, b, b + CRC_DMA_CHUNK);
+    if (i + 1 < chunks) {
+      commands[n].lo = 0;  // empty READ_SYNC waits until the next chunk is read
+      commands[n++].hi = DMA_CMD_HI(DMA_READ_SYNC, 0, 0);
+    }
+  }
+
+  DMA_REGS->crc32 = crc;
+  DMA_REGS->cmdAddress = (void*)commands;
+  asm volatile("fence ow, ow");
+  DMA_REGS->cmdCount = n;
+  asm volatile("fence o, i");
+  while (!DMA_REGS->int_stat);
+  return DMA_REGS->crc32;
+}
+
+unsigned crc32(const char* data, int size) {
+  unsigned crc = 0;
+  if ((BOARD_REGS->cpu_features[get_hartid()] & CPU_FEATURES_DMA) && size >= 2 * CRC_DMA_CHUNK) {
+    int head = -(unsigned long)data & 63;
+    crc = crc32_soft(crc, data, head);
+    data += head;
+    size -= head;
+    while (size >= CRC_DMA_CHUNK) {
+      int chunks = size / CRC_DMA_CHUNK;
+      if (chunks > CRC_DMA_BATCH) chunks = CRC_DMA_BATCH;
+      crc = crc32_dma(crc, data, chunks);
+      data += chunks * CRC_DMA_CHUNK;
+      size -= chunks * CRC_DMA_CHUNK;
+    }
+  }
+  return crc32_soft(crc, data, size);
+}
+
 void uart_flush() {
   while (1) {
     wait(1000);
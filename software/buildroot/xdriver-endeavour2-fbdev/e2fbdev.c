@@ -765,7 +765,76 @@ fbdevUpdate32to24(ScreenPtr pScreen, shadowBufPtr pBuf)
 static void
 fbdevUpdateRotatePacked(ScreenPtr pScreen, shadowBufPtr pBuf)
 {
-    shadowUpdateRotatePacked(pScreen, pBuf);
+    ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
+    FBDevPtr fPtr = FBDEVPTR(pScrn);
+    int shadow_line_size = pBuf->pPixmap->devKind;
+    int width = pScreen->width, height = pScreen->height;  // shadow size, the framebuffer is height x width
+    int cw = fPtr->rotate == FBDEV_ROTATE_CW;
+
+    // Tiles are 32x32 pixels, framebuffer lines are padded to 32 pixels by the last tile column.
+    if (fPtr->rotate == FBDEV_ROTATE_UD || (shadow_line_size & 63) || ((height + 31) & ~31) * 2 > GRAPHIC_LINE_SIZE) {
+        shadowUpdateRotatePacked(pScreen, pBuf);
+        return;
+    }
+
+    RegionPtr damage = DamageRegion(pBuf->pDamage);
+    int nbox = RegionNumRects(damage);
+    BoxPtr pbox = RegionRects(damage);
+    DmaCmdPtr cmds = fPtr->dma_commands;
+
+    // Source tiles are read alternately to [0, 2048) and [2048, 4096), transposed to [4096, 6144).
+    // The next tile is read while the previous one is transposed and written.
+    enum { TILE_SIZE = 2048, OUT_BUF = 4096 };
+    unsigned tile = 0, prev_dst = 0, prev_lines = 0;
+
+    // Clockwise: shadow (x, y) goes to framebuffer (height - 1 - y, x), tile lines are read from the bottom.
+    // Counterclockwise: shadow (x, y) goes to framebuffer (y, width - 1 - x), result lines are written from the bottom.
+    cmds->lo = cw ? DMA_RECT_STRIDES(-shadow_line_size, GRAPHIC_LINE_SIZE)
+                  : DMA_RECT_STRIDES(shadow_line_size, -GRAPHIC_LINE_SIZE);
+    cmds->hi = DMA_CMD_HI(DMA_RECT_SETUP, 0, 64);
+    cmds++;
+
+    while (nbox--) {
+        int fx1 = cw ? height - pbox->y2 : pbox->y1;  // framebuffer x range of the box
+        int fx2 = cw ? height - pbox->y1 : pbox->y2;
+        for (int tx = pbox->x1 & ~31; tx < pbox->x2; tx += 32) {
+            // result line L is shadow column tx + L
+            unsigned lines = width - tx < 32 ? width - tx : 32;
+            for (int fx = fx1 & ~31; fx < fx2; fx += 32) {
+                int sy = cw ? height - 1 - fx : fx;  // first tile line
+                unsigned buf = (tile & 1) * TILE_SIZE;
+                if (tile > 0) {
+                    cmds->lo = 0;  // empty READ_SYNC waits until the previous tile is read
+                    cmds->hi = DMA_CMD_HI(DMA_READ_SYNC, 0, 0);
+                    cmds++;
+                }
+                cmds->lo = SHADOW_ADDR + sy * shadow_line_size + tx * 2;
+                cmds->hi = DMA_CMD_HI(DMA_RECT_READ, buf, buf + TILE_SIZE);
+                cmds++;
+                if (tile > 0) {
+                    cmds[0].lo = TILE_SIZE - buf;
+                    cmds[0].hi = DMA_CMD_HI(DMA_TRANSPOSE, OUT_BUF, OUT_BUF + TILE_SIZE);
+                    cmds[1].lo = prev_dst;
+                    cmds[1].hi = DMA_CMD_HI(DMA_RECT_WRITE, OUT_BUF, OUT_BUF + prev_lines * 64);
+                    cmds += 2;
+                }
+                prev_dst = FRONT_ADDR + (cw ? tx : width - 1 - tx) * GRAPHIC_LINE_SIZE + fx * 2;
+                prev_lines = lines;
+                tile++;
+            }
+        }
+        pbox++;
+    }
+    if (tile > 0) {
+        cmds[0].lo = 0;
+        cmds[0].hi = DMA_CMD_HI(DMA_READ_SYNC, 0, 0);
+        cmds[1].lo = ((tile - 1) & 1) * TILE_SIZE;
+        cmds[1].hi = DMA_CMD_HI(DMA_TRANSPOSE, OUT_BUF, OUT_BUF + TILE_SIZE);
+        cmds[2].lo = prev_dst;
+        cmds[2].hi = DMA_CMD_HI(DMA_RECT_WRITE_SYNC, OUT_BUF, OUT_BUF + prev_lines * 64);
+        cmds += 3;
+        display_dma(fPtr->e2_display_fd, DMA_CMD_ADDR, cmds - fPtr->dma_commands, /*sync=*/1);
+    }
 }
 
 static void
@@ -784,17 +853,21 @@ fbdevUpdatePacked(ScreenPtr pScreen, shadowBufPtr pBuf)
     while (nbox--) {
         unsigned from = (pbox->x1 & ~31) << 1;
         unsigned to = ((pbox->x2 + 31) & ~31) << 1;
-        unsigned cmd_read  = DMA_CMD_HI(DMA_READ_SYNC, from, to);
-        unsigned cmd_write = DMA_CMD_HI(DMA_WRITE_SYNC, from, to);
+        unsigned line_size = to - from;
+        unsigned max_lines = DMA_BUFFER_SIZE / line_size;
         unsigned src = SHADOW_ADDR + pbox->y1 * shadow_line_size + from;
         unsigned dst = FRONT_ADDR + pbox->y1 * GRAPHIC_LINE_SIZE + from;
-        for (unsigned y = pbox->y1; y < pbox->y2; ++y) {
+        cmds->lo = DMA_RECT_STRIDES(shadow_line_size, GRAPHIC_LINE_SIZE);
+        cmds->hi = DMA_CMD_HI(DMA_RECT_SETUP, 0, line_size);
+        cmds++;
+        for (unsigned y = pbox->y1; y < pbox->y2; y += max_lines) {
+            unsigned lines = pbox->y2 - y < max_lines ? pbox->y2 - y : max_lines;
             cmds[0].lo = src;
-            cmds[0].hi = cmd_read;
+            cmds[0].hi = DMA_CMD_HI(DMA_RECT_READ_SYNC, 0, lines * line_size);
             cmds[1].lo = dst;
-            cmds[1].hi = cmd_write;
-            src += shadow_line_size;
-            dst += GRAPHIC_LINE_SIZE;
+            cmds[1].hi = DMA_CMD_HI(DMA_RECT_WRITE_SYNC, 0, lines * line_size);
+            src += lines * shadow_line_size;
+            dst += lines * GRAPHIC_LINE_SIZE;
             cmds += 2;
         }
         pbox++;
@@ -1042,7 +1115,9 @@ FBDevScreenInit(SCREEN_INIT_ARGS_DECL)
 	if(fPtr->rotate==FBDEV_ROTATE_CW || fPtr->rotate==FBDEV_ROTATE_CCW)
 	{
 	  int tmp = pScrn->virtualX;
-	  pScrn->virtualX = pScrn->displayWidth = pScrn->virtualY;
+	  pScrn->virtualX = pScrn->virtualY;
+	  /* DMA rotation and copies need 64-byte aligned shadow lines */
+	  pScrn->displayWidth = (pScrn->virtualX + 31) & ~31;
 	  pScrn->virtualY = tmp;
 	} else if (!fPtr->shadowFB) {
 		/* FIXME: this doesn't work for all cases, e.g. when each scanline
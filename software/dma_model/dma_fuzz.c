@@ -0,0 +1,318 @@
+// Generates random DMA programs, runs them through the C model and writes test vectors for
+// DmaControllerFuzz (rtl/src/main/scala/endeavour2/DmaControllerFuzz.scala), which runs the same programs
+// in the SpinalHDL simulation and compares the resulting memory.
+//
+// Usage: dma_fuzz <vectors file> [cases] [seed]
+//
+// File format (little endian):
+//   u32 magic "DMAF", u32 case count, u32 image size, u32 command address
+//   for every case: u32 command count, initial memory image, expected memory image
+//
+// Memory image layout:
+//   [0x00000, 0x10000) - data, random on start; all memory operations stay in this range
+//   [0x10000, 0x18000) - commands
+//   [0x18000, 0x19f80) - buffer contents at the end of the program
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endeavour2/raw/defs.h>
+
+#include "dma_model.h"
+
+#define IMAGE_SIZE   0x20000
+#define DATA_BLOCKS  (0x10000 / 64)
+#define CMD_ADDR     0x10000
+#define MAX_COMMANDS 4096
+#define DUMP_ADDR    0x18000
+#define MARGIN       16  // bytes between source and destination of buffer operations
+
+static uint8_t image[IMAGE_SIZE];
+static uint8_t initial_image[IMAGE_SIZE];
+static uint32_t rng_state;
+
+static uint32_t rnd(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+// Random number in [a, b]
+static int rnd_range(int a, int b) { return a + (int)(rnd() % (uint32_t)(b - a + 1)); }
+
+struct Program {
+  uint32_t lo[MAX_COMMANDS], hi[MAX_COMMANDS];
+  int count;
+  int rect_line_blocks, rect_src_stride, rect_dst_stride;
+  int loop_count, loop_read_inc, loop_write_inc;  // loop_count is 1 outside of loops
+  uint32_t resample_step;
+  int async_reads, async_writes;  // asynchronous memory operations since the last _SYNC
+};
+
+static void emit(struct Program* p, uint32_t lo, uint32_t hi) {
+  p->lo[p->count] = lo;
+  p->hi[p->count] = hi;
+  p->count++;
+}
+
+static int overlaps(int a_start, int a_end, int b_start, int b_end) {
+  return a_start < b_end + MARGIN && b_start < a_end + MARGIN;
+}
+
+// Picks a memory block address for an operation with `blocks` blocks, so that all blocks it touches
+// (including rectangle lines and loop iterations) are in the data area. Returns -1 if impossible.
+static int pick_mem_addr(struct Program* p, int rect, int write, int blocks) {
+  int lo = 0, hi = blocks - 1;
+  if (rect) {
+    int lines = (blocks + p->rect_line_blocks - 1) / p->rect_line_blocks;
+    int span = (lines - 1) * (write ? p->rect_dst_stride : p->rect_src_stride);
+    lo = span < 0 ? span : 0;
+    hi = (span > 0 ? span : 0) + p->rect_line_blocks - 1;
+  }
+  int loop_span = (p->loop_count - 1) * (write ? p->loop_write_inc : p->loop_read_inc);
+  if (loop_span < 0) lo += loop_span; else hi += loop_span;
+  if (hi - lo >= DATA_BLOCKS) return -1;
+  return rnd_range(-lo, DATA_BLOCKS - 1 - hi);
+}
+
+static void gen_rect_setup(struct Program* p) {
+  p->rect_line_blocks = rnd_range(1, 8);
+  p->rect_src_stride = rnd_range(-16, 16);
+  // lines of one RECT_WRITE must not overlap
+  p->rect_dst_stride = rnd_range(p->rect_line_blocks, 16) * (rnd() & 1 ? 1 : -1);
+  emit(p, ((p->rect_dst_stride & 0xffff) << 16) | (p->rect_src_stride & 0xffff),
+       DMA_CMD_HI(DMA_RECT_SETUP, 0, p->rect_line_blocks * 64));
+}
+
+static void gen_resample_setup(struct Program* p) {
+  p->resample_step = rnd_range(1, 0x10000);
+  emit(p, p->resample_step, DMA_CMD_HI(DMA_RESAMPLE_SETUP, 0, 0));
+}
+
+static void gen_expand_setup(struct Program* p) {
+  emit(p, rnd(), DMA_CMD_HI(DMA_EXPAND_SETUP, 0, 0));
+}
+
+static void gen_mem_op(struct Program* p) {
+  int rect = rnd() & 1;
+  int write = rnd() & 1;
+  int blocks = rnd_range(1, rect ? 32 : 16);
+  int addr = pick_mem_addr(p, rect, write, blocks);
+  if (addr < 0) return;
+  int b0 = rnd_range(0, DMA_MODEL_BUFFER_SIZE / 64 - blocks);
+  int b_from = b0 * 64, b_to = (b0 + blocks) * 64 + rnd_range(0, 63);
+  if (write) {
+    // writes take words from b_from/8, which must stay out of the command area
+    b_from += rnd_range(0, DMA_MODEL_BUFFER_SIZE - blocks * 64 - b_from) & 56;
+  } else {
+    b_from += rnd_range(0, 63);
+  }
+  unsigned opcode = (rect ? DMA_RECT_READ_SYNC : DMA_READ_SYNC) | write;
+  // buffer hazards of asynchronous operations are handled by the controller, memory hazards are not
+  if (p->async_writes || (write && p->async_reads)) {
+    emit(p, 0, DMA_CMD_HI(DMA_READ_SYNC, 0, 0));
+    p->async_reads = p->async_writes = 0;
+  }
+  if (p->loop_count == 1 && (rnd() & 1)) {
+    opcode &= ~2;
+    if (write) p->async_writes = 1; else p->async_reads = 1;
+  } else {
+    p->async_reads = p->async_writes = 0;
+  }
+  emit(p, addr * 64, DMA_CMD_HI(opcode, b_from, b_to));
+}
+
+// Picks a source range of `len` bytes for a buffer operation writing [from, to).
+static int pick_source(int from, int to, int len) {
+  for (int attempt = 0; attempt < 100; ++attempt) {
+    int src = rnd_range(MARGIN, DMA_MODEL_BUFFER_SIZE - MARGIN - len);
+    if (!overlaps(src, src + len, from, to)) return src;
+  }
+  return -1;
+}
+
+static void gen_buffer_op(struct Program* p) {
+  static const unsigned opcodes[] = {DMA_SET, DMA_COPY, DMA_LOADMAP, DMA_MAP1R2, DMA_MAP1R4, DMA_EXPAND,
+                                    DMA_EXPAND_TRANSPARENT, DMA_TRANSPOSE, DMA_MIXRGB,
+                                    DMA_BLEND, DMA_BLEND_RGAB, DMA_RESAMPLE, DMA_RESAMPLE_LINEAR,
+                                    DMA_YUV420};
+  unsigned opcode = opcodes[rnd() % (sizeof(opcodes) / sizeof(opcodes[0]))];
+  int len = rnd_range(1, rnd() & 1 ? 64 : 1024);
+  int from = rnd_range(0, DMA_MODEL_BUFFER_SIZE - MARGIN - len);
+  if (opcode == DMA_RESAMPLE || opcode == DMA_RESAMPLE_LINEAR || opcode == DMA_YUV420 ||
+      opcode == DMA_EXPAND || opcode == DMA_EXPAND_TRANSPARENT) {
+    from &= ~7;
+  }
+  int to = from + len;
+  int words = ((to + 7) >> 3) - (from >> 3);
+  int src, farg = 0;
+  switch (opcode) {
+    case DMA_SET:
+      emit(p, rnd(), DMA_CMD_HI(opcode, from, to));
+      return;
+    case DMA_MAP1R4: src = pick_source(from, to, (words / 4 + 2) * 8); break;
+    case DMA_MAP1R2: src = pick_source(from, to, (words / 2 + 2) * 8); break;
+    case DMA_LOADMAP: src = pick_source(0, 0, len + 8); break;
+    case DMA_RESAMPLE:
+    case DMA_RESAMPLE_LINEAR:
+      // source pixels [src/2, src/2 + words * 4 * step + 1], rounded to words, plus the word read after them
+      src = pick_source(from, to, (int)(((uint64_t)words * 4 * p->resample_step >> 16) * 2) + 32);
+      if (src < 0) return;
+      emit(p, (rnd() << 16) | (src & ~1), DMA_CMD_HI(opcode, from, to));
+      return;
+    case DMA_EXPAND:
+    case DMA_EXPAND_TRANSPARENT:
+      // 4 bits per output word
+      src = pick_source(from, to, words / 2 + 16);
+      if (src < 0) return;
+      emit(p, (rnd() & (1 << 13)) | src, DMA_CMD_HI(opcode, from, to));
+      return;
+    case DMA_TRANSPOSE:
+      // whole 2 KB tiles, 64-byte aligned
+      from &= ~63;
+      to = from + 2048 * rnd_range(1, 2);
+      if (to + MARGIN > DMA_MODEL_BUFFER_SIZE) return;
+      src = pick_source(from, to, to - from + 64) & ~63;
+      if (src < 0 || overlaps(src, src + to - from, from, to)) return;
+      emit(p, src, DMA_CMD_HI(opcode, from, to));
+      return;
+    case DMA_YUV420:
+      // Y - 4 bytes per output word, U and V - 2 bytes; V is 64-byte blocks after U
+      src = pick_source(from, to, words * 4 + 16);
+      farg = pick_source(from, to, words * 2 + 16);
+      if (src < 0 || farg < 0 || overlaps(src, src + words * 4 + 16, farg, farg + words * 2 + 16)) return;
+      for (int attempt = 0; attempt < 100; ++attempt) {
+        int v = farg + rnd_range(0, 63) * 64;
+        if (v + words * 2 + 16 + MARGIN > DMA_MODEL_BUFFER_SIZE || overlaps(v, v + words * 2 + 16, from, to)) continue;
+        emit(p, ((v - farg) << 20) | DMA_CMD_LO(farg & ~1, src & ~3), DMA_CMD_HI(opcode, from, to));
+        return;
+      }
+      return;
+    default: src = pick_source(from, to, len + 8); break;
+  }
+  if (src < 0) return;
+  if (opcode >= DMA_MIXRGB) {
+    farg = pick_source(from, to, words * 8 + 8);
+    if (farg < 0 || overlaps(farg, farg + words * 8 + 8, src, src + len + 8)) return;
+  } else if (opcode == DMA_MAP1R2 || opcode == DMA_MAP1R4) {
+    farg = rnd() & 8191;  // bits 11..10 select the palette
+  }
+  // sources of map operations are word aligned
+  if (opcode == DMA_MAP1R2 || opcode == DMA_MAP1R4) src = (src & ~7) + (from & 7);
+  uint32_t alpha = opcode == DMA_BLEND || opcode == DMA_BLEND_RGAB ? rnd() << 26 : 0;
+  emit(p, alpha | DMA_CMD_LO(farg, src), DMA_CMD_HI(opcode, from, to));
+}
+
+static void gen_op(struct Program* p) {
+  switch (rnd() % 10) {
+    case 0: case 1: case 2: gen_mem_op(p); break;
+    case 3: if (p->loop_count == 1) gen_rect_setup(p); break;
+    case 4: if (rnd() & 1) gen_resample_setup(p); else gen_expand_setup(p); break;
+    default: gen_buffer_op(p); break;
+  }
+}
+
+static void gen_program(struct Program* p) {
+  int jumps[16], jump_count = 0;
+  memset(p, 0, sizeof(*p));
+  p->loop_count = 1;
+
+  // define the whole buffer and map buffer
+  emit(p, rnd_range(0, DATA_BLOCKS - DMA_MODEL_BUFFER_SIZE / 64) * 64, DMA_CMD_HI(DMA_READ_SYNC, 0, DMA_MODEL_BUFFER_SIZE));
+  emit(p, 0, DMA_CMD_HI(DMA_LOADMAP, 0, 4096));
+  gen_rect_setup(p);
+  gen_resample_setup(p);
+  gen_expand_setup(p);
+
+  int ops = rnd_range(8, 48);
+  for (int i = 0; i < ops; ++i) {
+    int kind = rnd() % 16;
+    if (kind == 0 && jump_count < 16) {
+      jumps[jump_count++] = p->count;
+      emit(p, 0, 0);  // filled below
+      for (int skip = rnd_range(0, 3); skip > 0; --skip) emit(p, rnd(), rnd());
+      p->lo[jumps[jump_count - 1]] = CMD_ADDR + p->count * 8;
+    } else if (kind == 1) {
+      p->loop_count = rnd_range(1, 6);
+      p->loop_read_inc = rnd_range(-4, 4);
+      p->loop_write_inc = rnd_range(-4, 4);
+      emit(p, ((p->loop_write_inc & 0xffff) << 16) | (p->loop_read_inc & 0xffff), (DMA_LOOP << 26) | p->loop_count);
+      for (int body = rnd_range(1, 3); body > 0; --body) gen_op(p);
+      emit(p, 0, DMA_ENDLOOP << 26);
+      p->loop_count = 1;
+    } else {
+      gen_op(p);
+    }
+  }
+  emit(p, DUMP_ADDR, DMA_CMD_HI(DMA_WRITE_SYNC, 0, DMA_MODEL_BUFFER_SIZE));
+
+  for (int i = 0; i < jump_count; ++i) {
+    int target = (p->lo[jumps[i]] - CMD_ADDR) / 8;
+    p->hi[jumps[i]] = (DMA_JUMP << 26) | (p->count - target);
+  }
+}
+
+static void put32(uint8_t* dst, uint32_t v) {
+  for (int i = 0; i < 4; ++i) dst[i] = v >> (i * 8);
+}
+
+static void write32(FILE* f, uint32_t v) {
+  uint8_t b[4];
+  put32(b, v);
+  fwrite(b, 4, 1, f);
+}
+
+int main(int argc, char** argv) {
+  static struct Program p;
+  static struct DmaModel model;
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <vectors file> [cases] [seed]\n", argv[0]);
+    return 1;
+  }
+  int cases = argc > 2 ? atoi(argv[2]) : 50;
+  rng_state = argc > 3 ? strtoul(argv[3], 0, 0) : 1;
+  if (!rng_state) rng_state = 1;
+
+  FILE* f = fopen(argv[1], "wb");
+  if (!f) {
+    perror(argv[1]);
+    return 1;
+  }
+  write32(f, 0x464d4144);  // "DMAF"
+  write32(f, cases);
+  write32(f, IMAGE_SIZE);
+  write32(f, CMD_ADDR);
+
+  struct DmaModelStats total = {0};
+  for (int c = 0; c < cases; ++c) {
+    gen_program(&p);
+    memset(image, 0, IMAGE_SIZE);
+    for (int i = 0; i < DATA_BLOCKS * 64; ++i) image[i] = rnd();
+    for (int i = 0; i < p.count; ++i) {
+      put32(image + CMD_ADDR + i * 8, p.lo[i]);
+      put32(image + CMD_ADDR + i * 8 + 4, p.hi[i]);
+    }
+    memcpy(initial_image, image, IMAGE_SIZE);
+
+    dma_model_init(&model, image, 0, IMAGE_SIZE);
+    if (dma_model_run(&model, CMD_ADDR, p.count)) {
+      fprintf(stderr, "case %d: %s\n", c, model.error);
+      return 1;
+    }
+    total.commands += model.stats.commands;
+    total.mem_read_blocks += model.stats.mem_read_blocks;
+    total.mem_write_blocks += model.stats.mem_write_blocks;
+    total.buffer_words += model.stats.buffer_words;
+    total.cycles += model.stats.cycles;
+
+    write32(f, p.count);
+    fwrite(initial_image, IMAGE_SIZE, 1, f);
+    fwrite(image, IMAGE_SIZE, 1, f);
+  }
+  fclose(f);
+  printf("%d cases: %u commands, %u blocks read, %u blocks written, %u buffer words, ~%llu cycles\n",
+         cases, total.commands, total.mem_read_blocks, total.mem_write_blocks, total.buffer_words,
+         (unsigned long long)total.cycles);
+  return 0;
+}
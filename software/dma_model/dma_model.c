@@ -0,0 +1,364 @@
+#include "dma_model.h"
+
+#include <string.h>
+#include <endeavour2/raw/defs.h>
+
+#define BLOCK_MASK 0xffffff  // memory address in 64-byte blocks, 24 bits
+
+// Rough cycle costs used by the estimator
+#define CYCLES_PER_COMMAND   4
+#define CYCLES_PER_BLOCK     8   // 8 beats of 64 bits
+#define CYCLES_SYNC_LATENCY  40
+#define CYCLES_PIPELINE_FILL 6
+
+static uint32_t load32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t buf_word(const struct DmaModel* m, uint32_t word) {
+  const uint8_t* p = m->buffer + ((word & 1023) << 3);
+  return load32(p) | ((uint64_t)load32(p + 4) << 32);
+}
+
+static void buf_write_word(struct DmaModel* m, uint32_t word, uint64_t v, unsigned mask) {
+  uint8_t* p = m->buffer + ((word & 1023) << 3);
+  for (int i = 0; i < 8; ++i) {
+    if (mask & (1 << i)) p[i] = v >> (i * 8);
+  }
+}
+
+// 8 bytes starting from an arbitrary buffer byte address (wraps at 8192).
+static uint64_t buf_unaligned(const struct DmaModel* m, uint32_t addr) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; ++i) v |= (uint64_t)m->buffer[(addr + i) & 8191] << (i * 8);
+  return v;
+}
+
+static uint32_t sext16(uint32_t v) { return (uint32_t)(int32_t)(int16_t)v & BLOCK_MASK; }
+
+static uint8_t* mem_block(struct DmaModel* m, uint32_t block) {
+  uint32_t addr = (block & BLOCK_MASK) << 6;
+  if (addr < m->mem_base || addr - m->mem_base + 64 > m->mem_size) {
+    m->error = "memory access outside of the image";
+    return 0;
+  }
+  return m->mem + (addr - m->mem_base);
+}
+
+// READ, WRITE, RECT_READ, RECT_WRITE and their _SYNC variants.
+// Reads fill whole 64-byte buffer blocks starting from b_from/64; writes take words starting from b_from/8.
+static int mem_op(struct DmaModel* m, unsigned opcode, uint32_t b_from, uint32_t b_to, uint32_t d32) {
+  int write = opcode & 1;
+  int rect = opcode & 16;
+  uint32_t blocks = ((b_to >> 6) - (b_from >> 6)) & 127;
+  uint32_t addr = (((d32 >> 6) & BLOCK_MASK) + (write ? m->loop_write_offset : m->loop_read_offset)) & BLOCK_MASK;
+  uint32_t line_addr = addr;
+  uint32_t line_counter = m->rect_line_blocks;
+  uint32_t stride = write ? m->rect_dst_stride : m->rect_src_stride;
+  for (uint32_t i = 0; i < blocks; ++i) {
+    uint8_t* p = mem_block(m, addr);
+    if (!p) return -1;
+    if (write) {
+      for (int j = 0; j < 8; ++j) {
+        uint32_t word = (b_from >> 3) + i * 8 + j;
+        memcpy(p + j * 8, m->buffer + ((word & 1023) << 3), 8);
+      }
+    } else {
+      memcpy(m->buffer + ((((b_from >> 6) + i) & 127) << 6), p, 64);
+    }
+    if (rect && line_counter == 1) {
+      line_addr = (line_addr + stride) & BLOCK_MASK;
+      addr = line_addr;
+      line_counter = m->rect_line_blocks;
+    } else {
+      addr = (addr + 1) & BLOCK_MASK;
+      line_counter = (line_counter - 1) & 127;
+    }
+  }
+  if (write) {
+    m->stats.mem_write_blocks += blocks;
+  } else {
+    m->stats.mem_read_blocks += blocks;
+  }
+  m->stats.cycles += blocks * CYCLES_PER_BLOCK + ((opcode & 2) ? CYCLES_SYNC_LATENCY : 0);
+  return 0;
+}
+
+static uint64_t mixrgb(uint64_t a, uint64_t b) {
+  uint64_t res = 0;
+  for (int i = 0; i < 64; i += 16) {
+    unsigned x = a >> i, y = b >> i;
+    unsigned blue = ((x & 0x1f) + (y & 0x1f)) >> 1;
+    unsigned green = (((x >> 5) & 0x3f) + ((y >> 5) & 0x3f)) >> 1;
+    unsigned red = (((x >> 11) & 0x1f) + ((y >> 11) & 0x1f)) >> 1;
+    res |= (uint64_t)((red << 11) | (green << 5) | blue) << i;
+  }
+  return res;
+}
+
+// Channel-wise (x * alpha + y * (64 - alpha) + 32) >> 6; with `rgab` x is RGAB5515 and opaque if A=1.
+static unsigned blend_pixel(unsigned x, unsigned y, unsigned alpha, int rgab) {
+  unsigned w = rgab && (x & 0x20) ? 64 : alpha;
+  unsigned xg = rgab ? (((x >> 6) & 0x1f) << 1) | ((x >> 10) & 1) : (x >> 5) & 0x3f;
+  unsigned blue = ((x & 0x1f) * w + (y & 0x1f) * (64 - w) + 32) >> 6;
+  unsigned green = (xg * w + ((y >> 5) & 0x3f) * (64 - w) + 32) >> 6;
+  unsigned red = (((x >> 11) & 0x1f) * w + ((y >> 11) & 0x1f) * (64 - w) + 32) >> 6;
+  return (red << 11) | (green << 5) | blue;
+}
+
+static uint64_t blend(uint64_t a, uint64_t b, unsigned alpha, int rgab) {
+  uint64_t res = 0;
+  for (int i = 0; i < 64; i += 16) {
+    res |= (uint64_t)blend_pixel((a >> i) & 0xffff, (b >> i) & 0xffff, alpha, rgab) << i;
+  }
+  return res;
+}
+
+// Output word `k` of RESAMPLE/RESAMPLE_LINEAR. `start` is the source position of the first output pixel
+// (pixel index in buffer, 16 fractional bits).
+static uint64_t resample(const struct DmaModel* m, uint32_t start, uint32_t k, int linear) {
+  uint32_t pos = start + k * (m->resample_step << 2);
+  uint32_t word = (pos >> 18) & 1023;
+  uint64_t res = 0;
+  for (int i = 0; i < 4; ++i) {
+    uint32_t p = (pos & 0x3ffff) + i * m->resample_step;
+    uint32_t index = (p >> 16) & 7;
+    unsigned a = buf_word(m, word + index / 4) >> ((index & 3) * 16) & 0xffff;
+    unsigned b = buf_word(m, word + ((index + 1) & 7) / 4) >> (((index + 1) & 3) * 16) & 0xffff;
+    res |= (uint64_t)blend_pixel(b, a, linear ? (p >> 10) & 63 : 0, 0) << (i * 16);
+  }
+  return res;
+}
+
+static unsigned clamp_yuv(int v) {
+  v = (v + 128) >> 8;
+  return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+// Output word `k` of YUV420: Y at byte address y, U at u, V at v.
+static uint64_t yuv420(const struct DmaModel* m, uint32_t y, uint32_t u, uint32_t v, uint32_t k) {
+  uint64_t res = 0;
+  for (int i = 0; i < 4; ++i) {
+    int c = m->buffer[(y + k * 4 + i) & 8191] - 16;
+    int d = m->buffer[(u + k * 2 + i / 2) & 8191] - 128;
+    int e = m->buffer[(v + k * 2 + i / 2) & 8191] - 128;
+    unsigned red = clamp_yuv(298 * c + 409 * e);
+    unsigned green = clamp_yuv(298 * c - 100 * d - 208 * e);
+    unsigned blue = clamp_yuv(298 * c + 516 * d);
+    res |= (uint64_t)(((red >> 3) << 11) | ((green >> 2) << 5) | (blue >> 3)) << (i * 16);
+  }
+  return res;
+}
+
+// Two map entries selected by the bytes of 16-bit chunk `item % 4` of source word `item / 4`.
+static void map_pair(const struct DmaModel* m, uint32_t b_arg, uint32_t palette, uint32_t item,
+                     uint32_t* lo, uint32_t* hi) {
+  uint64_t src = buf_word(m, (b_arg >> 3) + item / 4);
+  unsigned indices = src >> ((item & 3) * 16);
+  *lo = m->map[palette | (indices & 0xff)];
+  *hi = m->map[palette | ((indices >> 8) & 0xff)];
+}
+
+static uint32_t crc32_update(uint32_t crc, uint64_t data) {
+  crc = ~crc;
+  for (int i = 0; i < 64; ++i) {
+    unsigned b = (crc ^ (uint32_t)(data >> i)) & 1;
+    crc = (crc >> 1) ^ (b ? 0xedb88320 : 0);
+  }
+  return ~crc;
+}
+
+// Output word `k` of EXPAND: 4 pixels from bits [4k, 4k + 4) of the bitmap at byte address `src`.
+// Returns the source bits in *bits.
+static uint64_t expand(const struct DmaModel* m, uint32_t src, int msb_first, uint32_t k, unsigned* bits) {
+  unsigned byte = m->buffer[(src + k / 2) & 8191];
+  if (msb_first) {
+    unsigned r = 0;
+    for (int i = 0; i < 8; ++i) r |= ((byte >> i) & 1) << (7 - i);
+    byte = r;
+  }
+  *bits = (byte >> ((k & 1) * 4)) & 15;
+  uint64_t res = 0;
+  for (int i = 0; i < 4; ++i) {
+    res |= (uint64_t)((*bits >> i) & 1 ? m->expand_colors & 0xffff : m->expand_colors >> 16) << (i * 16);
+  }
+  return res;
+}
+
+// Output word `k` of TRANSPOSE: word k & 7 of line (k >> 3) & 31 of the transposed tile k >> 8.
+static uint64_t transpose(const struct DmaModel* m, uint32_t src, uint32_t k) {
+  uint32_t tile = src + (k >> 8) * 2048;
+  uint32_t line = (k >> 3) & 31, q = k & 7;
+  uint64_t res = 0;
+  for (int r = 0; r < 4; ++r) {
+    uint32_t addr = tile + (q * 4 + r) * 64 + line * 2;
+    res |= (uint64_t)(m->buffer[addr & 8191] | (m->buffer[(addr + 1) & 8191] << 8)) << (r * 16);
+  }
+  return res;
+}
+
+// SET, COPY, CRC32, LOADMAP, MAP1R2, MAP1R4, EXPAND, EXPAND_TRANSPARENT, TRANSPOSE, MIXRGB, BLEND, BLEND_RGAB, RESAMPLE, RESAMPLE_LINEAR, YUV420
+static int buffer_op(struct DmaModel* m, unsigned opcode, uint32_t b_from, uint32_t b_to, uint32_t d32) {
+  uint32_t words = ((((b_to + 7) & 8191) >> 3) - (b_from >> 3)) & 1023;
+  uint32_t b_arg = (d32 - (b_from & 7)) & 8191;   // first argument, shifted to the alignment of b_from
+  uint32_t b_arg2 = (d32 >> 13) & 8191;           // second argument, always word aligned
+  uint32_t palette = ((b_arg2 >> 10) & 3) << 8;
+  unsigned wmask_first = (0xff << (b_from & 7)) & 0xff;
+  unsigned wmask_last = 0xff >> ((8 - (b_to & 7)) & 7);
+  uint32_t res_word = b_from >> 3;
+  uint32_t lo, hi, lo2, hi2;
+  unsigned bits = 15;
+
+  if (words == 0) {
+    m->error = "empty buffer range (the controller hangs)";
+    return -1;
+  }
+  for (uint32_t k = 0; k < words; ++k) {
+    uint64_t sarg = opcode == DMA_SET ? (d32 | ((uint64_t)d32 << 32)) : buf_unaligned(m, b_arg + k * 8);
+    uint64_t res;
+    switch (opcode) {
+      case DMA_SET:
+      case DMA_COPY:
+        res = sarg;
+        break;
+      case DMA_CRC32:
+        m->crc32 = crc32_update(m->crc32, buf_word(m, (b_from >> 3) + k));
+        continue;
+      case DMA_LOADMAP:
+        m->map[((((b_from >> 3) + k) & 511) << 1) | 0] = sarg;
+        m->map[((((b_from >> 3) + k) & 511) << 1) | 1] = sarg >> 32;
+        continue;
+      case DMA_MAP1R4:
+        map_pair(m, b_arg, palette, k, &lo, &hi);
+        res = lo | ((uint64_t)hi << 32);
+        break;
+      case DMA_MAP1R2:
+        map_pair(m, b_arg, palette, k * 2, &lo, &hi);
+        map_pair(m, b_arg, palette, k * 2 + 1, &lo2, &hi2);
+        res = (lo & 0xffff) | ((uint64_t)(hi & 0xffff) << 16) | ((uint64_t)(lo2 & 0xffff) << 32) | ((uint64_t)(hi2 & 0xffff) << 48);
+        break;
+      case DMA_EXPAND:
+      case DMA_EXPAND_TRANSPARENT:
+        res = expand(m, b_arg, (d32 >> 13) & 1, k, &bits);
+        if (opcode == DMA_EXPAND) bits = 15;
+        break;
+      case DMA_TRANSPOSE:
+        res = transpose(m, b_arg, k);
+        break;
+      case DMA_MIXRGB:
+        res = mixrgb(sarg, buf_word(m, (b_arg2 >> 3) + k));
+        break;
+      case DMA_BLEND:
+      case DMA_BLEND_RGAB:
+        res = blend(sarg, buf_word(m, (b_arg2 >> 3) + k), d32 >> 26, opcode == DMA_BLEND_RGAB);
+        break;
+      case DMA_RESAMPLE:
+      case DMA_RESAMPLE_LINEAR:
+        res = resample(m, ((b_arg >> 1) << 16) | (d32 >> 16), k, opcode == DMA_RESAMPLE_LINEAR);
+        break;
+      case DMA_YUV420:
+        res = yuv420(m, b_arg, b_arg2, b_arg2 + (d32 >> 26) * 64, k);
+        break;
+      default:
+        m->error = "unsupported opcode";
+        return -1;
+    }
+    unsigned mask = 0xff;
+    if (k == 0) mask &= wmask_first;
+    if (k == words - 1) mask &= wmask_last;
+    for (int i = 0; i < 4; ++i) {
+      if (!((bits >> i) & 1)) mask &= ~(3u << (i * 2));
+    }
+    buf_write_word(m, res_word + k, res, mask);
+  }
+  m->stats.buffer_words += words;
+  m->stats.cycles += CYCLES_PIPELINE_FILL + words * (opcode >= DMA_MIXRGB || opcode == DMA_MAP1R2 ? 2 : 1);
+  return 0;
+}
+
+void dma_model_init(struct DmaModel* m, void* mem, uint32_t mem_base, uint32_t mem_size) {
+  memset(m, 0, sizeof(*m));
+  m->mem = mem;
+  m->mem_base = mem_base;
+  m->mem_size = mem_size;
+}
+
+int dma_model_run(struct DmaModel* m, uint32_t cmd_addr, uint32_t cmd_count) {
+  uint32_t pos = (cmd_addr >> 3) & ~7u;  // command address in 8-byte units
+  uint32_t counter = cmd_count & 0xffff;
+  uint32_t fetched_until = (pos >> 3) + 2;  // first two command blocks are read on start
+
+  m->error = 0;
+  m->stats.cmd_fetch_blocks += 2;
+  m->stats.cycles += CYCLES_SYNC_LATENCY;
+  while (counter > 0) {
+    if ((pos >> 3) >= fetched_until) {
+      fetched_until++;
+      m->stats.cmd_fetch_blocks++;
+    }
+    uint8_t* p = mem_block(m, pos >> 3);
+    if (!p) return -1;
+    uint32_t lo = load32(p + (pos & 7) * 8);
+    uint32_t hi = load32(p + (pos & 7) * 8 + 4);
+    pos++;
+    counter--;
+    m->stats.commands++;
+    m->stats.cycles += CYCLES_PER_COMMAND;
+
+    unsigned opcode = hi >> 26;
+    uint32_t b_from = (hi >> 13) & 8191;
+    uint32_t b_to = hi & 8191;
+    int res = 0;
+    switch (opcode) {
+      case DMA_READ: case DMA_WRITE: case DMA_READ_SYNC: case DMA_WRITE_SYNC:
+      case DMA_RECT_READ: case DMA_RECT_WRITE: case DMA_RECT_READ_SYNC: case DMA_RECT_WRITE_SYNC:
+        res = mem_op(m, opcode, b_from, b_to, lo);
+        break;
+      case DMA_RECT_SETUP:
+        m->rect_line_blocks = (b_to >> 6) & 127;
+        m->rect_src_stride = sext16(lo);
+        m->rect_dst_stride = sext16(lo >> 16);
+        break;
+      case DMA_RESAMPLE_SETUP:
+        m->resample_step = lo & 0x1ffff;
+        break;
+      case DMA_EXPAND_SETUP:
+        m->expand_colors = lo;
+        break;
+      case DMA_JUMP:
+        pos = (lo >> 3) & 0x7ffffff;
+        counter = hi & 0xffff;
+        fetched_until = (pos >> 3) + 2;
+        m->stats.cmd_fetch_blocks += 2;
+        m->stats.cycles += CYCLES_SYNC_LATENCY;
+        break;
+      case DMA_LOOP:
+        m->loop_pos = pos;
+        m->loop_counter = counter;
+        m->loop_remaining = hi & 0xffff;
+        m->loop_read_inc = sext16(lo);
+        m->loop_write_inc = sext16(lo >> 16);
+        m->loop_read_offset = m->loop_write_offset = 0;
+        break;
+      case DMA_ENDLOOP:
+        if (m->loop_remaining > 1) {
+          m->loop_remaining--;
+          m->loop_read_offset = (m->loop_read_offset + m->loop_read_inc) & BLOCK_MASK;
+          m->loop_write_offset = (m->loop_write_offset + m->loop_write_inc) & BLOCK_MASK;
+          pos = m->loop_pos;
+          counter = m->loop_counter;
+          fetched_until = (pos >> 3) + 2;
+          m->stats.cmd_fetch_blocks += 2;
+          m->stats.cycles += CYCLES_SYNC_LATENCY;
+        } else {
+          m->loop_read_offset = m->loop_write_offset = 0;
+        }
+        break;
+      default:
+        res = buffer_op(m, opcode, b_from, b_to, lo);
+        break;
+    }
+    if (res) return -1;
+  }
+  return 0;
+}
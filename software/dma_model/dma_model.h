@@ -0,0 +1,59 @@
+#ifndef ENDEAVOUR2_DMA_MODEL_H
+#define ENDEAVOUR2_DMA_MODEL_H
+
+#include <stdint.h>
+
+// Bit-exact software model of the DMA controller (rtl/src/main/scala/endeavour2/DmaController.scala).
+// Commands are executed one after another, so the model matches the hardware for programs without
+// memory hazards: asynchronous READ/WRITE must be followed by a _SYNC memory operation before the memory they
+// touch is used again (the controller tracks buffer blocks itself), and source and destination ranges of
+// buffer operations must not overlap.
+//
+// Memory is a flat image: DMA address A corresponds to mem[A - mem_base].
+// Buffer bytes [DMA_MODEL_BUFFER_SIZE, 8192) hold prefetched commands in hardware; the model keeps them as
+// plain buffer memory.
+
+#define DMA_MODEL_BUFFER_SIZE (8192 - 128)
+
+struct DmaModelStats {
+  uint32_t commands;          // executed commands, loop bodies are counted on every iteration
+  uint32_t cmd_fetch_blocks;  // 64-byte blocks read to fetch commands
+  uint32_t mem_read_blocks;   // 64-byte blocks read by READ/RECT_READ
+  uint32_t mem_write_blocks;  // 64-byte blocks written by WRITE/RECT_WRITE
+  uint32_t buffer_words;      // 64-bit words produced by buffer operations
+  uint64_t cycles;            // rough estimate of controller clock cycles, ignores memory latency overlap
+};
+
+struct DmaModel {
+  uint8_t* mem;
+  uint32_t mem_base, mem_size;
+
+  uint8_t buffer[8192];
+  uint32_t map[1024];
+
+  // RECT_SETUP state
+  uint32_t rect_line_blocks;
+  uint32_t rect_src_stride, rect_dst_stride;  // in 64-byte blocks, 24-bit two's complement
+
+  uint32_t resample_step;  // RESAMPLE_SETUP, 16 fractional bits
+  uint32_t expand_colors;  // EXPAND_SETUP: background (bits 31..16) and foreground (bits 15..0)
+  uint32_t crc32;          // CRC32 register as read over APB; set it before the program to continue a CRC
+
+  // LOOP state
+  uint32_t loop_pos, loop_counter, loop_remaining;
+  uint32_t loop_read_inc, loop_write_inc;
+  uint32_t loop_read_offset, loop_write_offset;
+
+  struct DmaModelStats stats;
+  const char* error;  // set when dma_model_run fails
+};
+
+// Buffer and map buffer are zero-initialized (they are undefined in hardware).
+void dma_model_init(struct DmaModel* m, void* mem, uint32_t mem_base, uint32_t mem_size);
+
+// Executes `cmd_count` commands starting from `cmd_addr` (64-byte aligned), like writing DMA cmdAddress/cmdCount.
+// Statistics are accumulated in m->stats. Returns 0 on success; -1 if the program accesses memory outside
+// of the image or uses an unsupported opcode (m->error describes the problem).
+int dma_model_run(struct DmaModel* m, uint32_t cmd_addr, uint32_t cmd_count);
+
+#endif  // ENDEAVOUR2_DMA_MODEL_H
@@ -142,16 +142,40 @@ enum DMA_OPCODE {
   DMA_WRITE_SYNC = 3,
   DMA_SET = 4,
   DMA_COPY = 5,
+  DMA_CRC32 = 6,
   DMA_LOADMAP = 7,
   DMA_MAP1R2 = 8,
   DMA_MAP1R4 = 9,
-  DMA_MIXRGB = 32
+  DMA_EXPAND = 10,
+  DMA_EXPAND_TRANSPARENT = 11,
+  DMA_TRANSPOSE = 12,
+  DMA_RECT_READ = 16,
+  DMA_RECT_WRITE = 17,
+  DMA_RECT_READ_SYNC = 18,
+  DMA_RECT_WRITE_SYNC = 19,
+  DMA_RECT_SETUP = 20,
+  DMA_JUMP = 21,
+  DMA_LOOP = 22,
+  DMA_ENDLOOP = 23,
+  DMA_RESAMPLE_SETUP = 24,
+  DMA_EXPAND_SETUP = 25,
+  DMA_MIXRGB = 32,
+  DMA_BLEND = 34,
+  DMA_BLEND_RGAB = 35,
+  DMA_RESAMPLE = 36,
+  DMA_RESAMPLE_LINEAR = 37,
+  DMA_YUV420 = 38
 };
 
 #define DMA_CMD_LO(b_farg, b_sarg) (((b_farg)<<13) | (b_sarg))
 #define DMA_CMD_HI(opcode, b_from, b_to) (((opcode)<<26) | ((b_from)<<13) | ((b_to)&0x1fff))
 #define DMA_BUFFER_SIZE (8192 - 128)
 
+// DMA_RECT_* operations process lines of RECT_SETUP line size packed in the buffer range [b_from, b_to).
+// Memory address advances by the source (reads) or destination (writes) stride after every line.
+// Strides are signed, must be multiples of 64, and are limited to +-2MB.
+#define DMA_RECT_STRIDES(src_stride, dst_stride) (((((int)(dst_stride)/64) & 0xffff) << 16) | (((int)(src_stride)/64) & 0xffff))
+
 #define DMA_PROGRAM_START(ADDR) \
     volatile struct { unsigned lo, hi; } *cmd_start = (void*)ADDR, *cmd = (void*)ADDR;
 
@@ -170,13 +194,191 @@ enum DMA_OPCODE {
     cmd->hi = DMA_CMD_HI(OPCODE, FROM, TO);           \
     cmd++;
 
+// DMA_BLEND / DMA_BLEND_RGAB: [FROM, TO) = SARG * ALPHA/64 + FARG * (64-ALPHA)/64 per RGB565 channel, ALPHA in [0, 63].
+// With DMA_BLEND_RGAB the SARG pixels are RGAB5515; pixels with A=1 are copied as is (green extended to 6 bits).
+#define DMA_PROGRAM_BLEND(OPCODE, FROM, TO, FARG, SARG, ALPHA)         \
+    cmd->lo = ((unsigned)(ALPHA) << 26) | ((FARG) << 13) | (SARG);     \
+    cmd->hi = DMA_CMD_HI(OPCODE, FROM, TO);                            \
+    cmd++;
+
+// Horizontal scaling of RGB565 lines. STEP is the source position increment per output pixel with 16 fractional
+// bits, 1..0x10000 (scale factor 1 or more). DMA_PROGRAM_RESAMPLE writes [FROM, TO) (FROM 8-byte aligned);
+// output pixel j samples the source line at SRC at position PHASE/65536 + j * STEP/65536 with OPCODE
+// DMA_RESAMPLE (nearest) or DMA_RESAMPLE_LINEAR. The source must not overlap [FROM, TO).
+// Vertical scaling is done by the command list: output line y uses source line (y * vstep) >> 16, or with linear
+// filtering resamples lines n and n+1 and blends them with DMA_BLEND, alpha = ((y * vstep) >> 10) & 63.
+// Palette-mapped lines are converted with DMA_MAP1R2 first.
+#define DMA_RESAMPLE_STEP(SRC_WIDTH, DST_WIDTH) (((unsigned)(SRC_WIDTH) << 16) / (DST_WIDTH))
+
+#define DMA_PROGRAM_RESAMPLE_SETUP(STEP)                \
+    cmd->lo = STEP;                                     \
+    cmd->hi = DMA_CMD_HI(DMA_RESAMPLE_SETUP, 0, 0);     \
+    cmd++;
+
+#define DMA_PROGRAM_RESAMPLE(OPCODE, FROM, TO, SRC, PHASE)  \
+    cmd->lo = ((unsigned)(PHASE) << 16) | (SRC);            \
+    cmd->hi = DMA_CMD_HI(OPCODE, FROM, TO);                 \
+    cmd++;
+
+// LINE_SIZE must be a multiple of 64.
+#define DMA_PROGRAM_RECT_SETUP(LINE_SIZE, SRC_STRIDE, DST_STRIDE) \
+    cmd->lo = DMA_RECT_STRIDES(SRC_STRIDE, DST_STRIDE);           \
+    cmd->hi = DMA_CMD_HI(DMA_RECT_SETUP, 0, LINE_SIZE);           \
+    cmd++;
+
+// Reads or writes LINES lines of LINE_SIZE bytes; buffer range is [FROM, FROM + LINES * LINE_SIZE).
+#define DMA_PROGRAM_RECT(OPCODE, FROM, LINE_SIZE, LINES, ADDR)         \
+    cmd->lo = ADDR;                                                    \
+    cmd->hi = DMA_CMD_HI(OPCODE, FROM, (FROM) + (LINES) * (LINE_SIZE)); \
+    cmd++;
+
+// Continues execution from ADDR (8-byte aligned) with COUNT commands. COUNT 0 ends the program.
+#define DMA_PROGRAM_JUMP(ADDR, COUNT)   \
+    cmd->lo = ADDR;                     \
+    cmd->hi = (DMA_JUMP<<26) | (COUNT); \
+    cmd++;
+
+// Executes commands up to DMA_PROGRAM_ENDLOOP COUNT times. After every iteration addresses of memory operations
+// in the loop body advance by READ_INC (reads) and WRITE_INC (writes). Increments are signed, multiples of 64.
+// Loops can't be nested.
+#define DMA_PROGRAM_LOOP(COUNT, READ_INC, WRITE_INC) \
+    cmd->lo = DMA_RECT_STRIDES(READ_INC, WRITE_INC); \
+    cmd->hi = (DMA_LOOP<<26) | (COUNT);              \
+    cmd++;
+
+#define DMA_PROGRAM_ENDLOOP()  \
+    cmd->lo = 0;               \
+    cmd->hi = DMA_ENDLOOP<<26; \
+    cmd++;
+
 #define DMA_PROGRAM_END(CNT) CNT = cmd - cmd_start;
 
+// [FROM, TO) = RGB565 of Y[j], U[j/2], V[j/2] (BT.601, limited range). FROM is 8-byte aligned, Y 4-byte aligned,
+// U 2-byte aligned, V is at U + V_OFFSET (multiple of 64, at most 4032).
+#define DMA_PROGRAM_YUV420(FROM, TO, Y, U, V_OFFSET)               \
+    cmd->lo = ((unsigned)(V_OFFSET) << 20) | ((U) << 13) | (Y);     \
+    cmd->hi = DMA_CMD_HI(DMA_YUV420, FROM, TO);                    \
+    cmd++;
+
+// Writes to `cmd_buf` a DMA program that converts a planar YUV 4:2:0 frame to RGB565, one line at a time.
+// All addresses are DMA (physical) addresses. Requirements: width is a multiple of 32 and at most 1920;
+// dst_addr and dst_stride are multiples of 64; y_addr and y_stride are multiples of 4; u_addr, v_addr and uv_stride
+// are even and u_addr - v_addr is a multiple of 64. Returns the number of commands, or 0 if the frame is not supported.
+static inline unsigned display_dma_yuv420_program(void* cmd_buf, unsigned width, unsigned height,
+    unsigned y_addr, unsigned y_stride, unsigned u_addr, unsigned v_addr, unsigned uv_stride,
+    unsigned dst_addr, unsigned dst_stride) {
+  // buffer: Y line at [0, 2048), U at [2048, 3072), V at [3072, 4096), RGB565 line at [4096, 7936)
+  enum { Y_BUF = 0, U_BUF = 2048, V_BUF = 3072, RGB_BUF = 4096 };
+  unsigned count, y, ya, ua = 0, va = 0;
+  if (width == 0 || width > 1920 || (width & 31) || ((dst_addr | dst_stride) & 63) || ((y_addr | y_stride) & 3) ||
+      ((u_addr | v_addr | uv_stride) & 1) || ((u_addr - v_addr) & 63)) {
+    return 0;
+  }
+  DMA_PROGRAM_START(cmd_buf);
+  for (y = 0; y < height; ++y) {
+    ya = y_addr + y * y_stride;
+    if ((y & 1) == 0) {
+      ua = u_addr + (y / 2) * uv_stride;
+      va = v_addr + (y / 2) * uv_stride;
+      DMA_PROGRAM_OP0(DMA_READ, Y_BUF, Y_BUF + (((ya & 63) + width + 63) & ~63), ya);
+      DMA_PROGRAM_OP0(DMA_READ, U_BUF, U_BUF + (((ua & 63) + width / 2 + 63) & ~63), ua);
+      DMA_PROGRAM_OP0(DMA_READ_SYNC, V_BUF, V_BUF + (((va & 63) + width / 2 + 63) & ~63), va);
+    } else {
+      DMA_PROGRAM_OP0(DMA_READ_SYNC, Y_BUF, Y_BUF + (((ya & 63) + width + 63) & ~63), ya);
+    }
+    DMA_PROGRAM_YUV420(RGB_BUF, RGB_BUF + width * 2, Y_BUF + (ya & 63), U_BUF + (ua & 63), V_BUF - U_BUF);
+    DMA_PROGRAM_OP0(DMA_WRITE, RGB_BUF, RGB_BUF + width * 2, dst_addr + y * dst_stride);
+  }
+  DMA_PROGRAM_END(count);
+  return count;
+}
+
+// 1bpp to RGB565: pixel j of [FROM, TO) (FROM 8-byte aligned) is FG if bit j of the bitmap at SRC is set, BG otherwise.
+// Bits are taken from the lowest bit of every byte, or from the highest if MSB_FIRST is set (as in fbdev images).
+// OPCODE is DMA_EXPAND or DMA_EXPAND_TRANSPARENT (pixels with clear bits keep their value).
+#define DMA_PROGRAM_EXPAND_SETUP(FG, BG)                                 \
+    cmd->lo = ((unsigned)(BG) << 16) | ((FG) & 0xffff);                  \
+    cmd->hi = DMA_CMD_HI(DMA_EXPAND_SETUP, 0, 0);                        \
+    cmd++;
+
+#define DMA_PROGRAM_EXPAND(OPCODE, FROM, TO, SRC, MSB_FIRST)  \
+    cmd->lo = ((MSB_FIRST) ? (1 << 13) : 0) | (SRC);          \
+    cmd->hi = DMA_CMD_HI(OPCODE, FROM, TO);                   \
+    cmd++;
+
+// Transposes 32x32 tiles of 16-bit pixels: line L of the result [FROM, TO) is column L of the source at SRC.
+// Tiles are 32 lines of 64 bytes one after another (as read by DMA_RECT_READ with 64-byte lines); FROM and SRC are
+// 64-byte aligned, TO - FROM is a multiple of 2048. 90-degree rotation: read the tile with a negative source stride
+// (clockwise) or write the result with a negative destination stride (counterclockwise).
+#define DMA_PROGRAM_TRANSPOSE(FROM, TO, SRC)       \
+    cmd->lo = SRC;                                \
+    cmd->hi = DMA_CMD_HI(DMA_TRANSPOSE, FROM, TO); \
+    cmd++;
+
+// Writes to `cmd_buf` a DMA program that draws a monochrome bitmap (glyphs, text lines) to an RGB565 image.
+// All addresses are DMA (physical) addresses. Bitmap lines are `src_stride` bytes apart; a line starts at the lowest
+// (or with `msb_first` the highest) bit of its first byte. With `transparent` pixels with clear bits are not drawn.
+// Requirements: width is at most 1920; dst_addr and dst_stride are multiples of 8 (4 pixels).
+// Returns the number of commands, or 0 if the bitmap is not supported.
+static inline unsigned display_dma_expand_program(void* cmd_buf, unsigned width, unsigned height,
+    unsigned src_addr, unsigned src_stride, unsigned msb_first, unsigned fg, unsigned bg, unsigned transparent,
+    unsigned dst_addr, unsigned dst_stride) {
+  // buffer: bitmap line at [0, 512), destination line at [512, 4608)
+  enum { SRC_BUF = 0, DST_BUF = 512 };
+  unsigned count, y, sa, da;
+  if (width == 0 || width > 1920 || ((dst_addr | dst_stride) & 7)) {
+    return 0;
+  }
+  DMA_PROGRAM_START(cmd_buf);
+  DMA_PROGRAM_EXPAND_SETUP(fg, bg);
+  for (y = 0; y < height; ++y) {
+    sa = src_addr + y * src_stride;
+    da = dst_addr + y * dst_stride;
+    DMA_PROGRAM_OP0(DMA_READ, SRC_BUF, SRC_BUF + (((sa & 63) + (width + 7) / 8 + 63) & ~63), sa);
+    DMA_PROGRAM_OP0(DMA_READ_SYNC, DST_BUF, DST_BUF + (((da & 63) + width * 2 + 63) & ~63), da);
+    DMA_PROGRAM_EXPAND(transparent ? DMA_EXPAND_TRANSPARENT : DMA_EXPAND, DST_BUF + (da & 63),
+                       DST_BUF + (da & 63) + width * 2, SRC_BUF + (sa & 63), msb_first);
+    DMA_PROGRAM_OP0(DMA_WRITE, DST_BUF, DST_BUF + (((da & 63) + width * 2 + 63) & ~63), da);
+  }
+  DMA_PROGRAM_END(count);
+  return count;
+}
+
+// Starts a command batch. Returns when all previously submitted batches are finished (so their command memory can
+// be reused), and if `wait_completion` is set, also this one. With cmd_count == 0 it only waits.
 static inline int display_dma(int fd, unsigned cmd_addr, unsigned cmd_count, unsigned wait_completion) {
   struct { unsigned cmd_addr, cmd_count, sync; } v = {cmd_addr, cmd_count, wait_completion};
   return ioctl(fd, 0xaab, &v);
 }
 
+// Queues a command batch and returns immediately. `*fence` is set to the id of the batch; fence ids increase
+// monotonically and batches are executed in order. Command memory must not be modified until the fence is reached.
+// poll() on the display fd reports POLLIN when all batches submitted through the fd are finished,
+// and POLLOUT when the submission queue has free space.
+static inline int display_dma_submit(int fd, unsigned cmd_addr, unsigned cmd_count, unsigned* fence) {
+  struct { unsigned cmd_addr, cmd_count, fence; } v = {cmd_addr, cmd_count, 0};
+  int res = ioctl(fd, 0xaac, &v);
+  *fence = v.fence;
+  return res;
+}
+
+static inline int display_dma_wait(int fd, unsigned fence) {
+  return ioctl(fd, 0xaad, fence);
+}
+
+// DMA controller performance counters, see struct EndeavourDMA in raw/defs.h.
+// Counters wrap around; compare values taken e.g. at the start and the end of a frame.
+struct DmaPerfCounters {
+  unsigned busy_cycles;   // cycles the controller is not idle
+  unsigned read_beats;    // 8-byte memory read beats, including command fetch
+  unsigned write_beats;   // 8-byte memory write beats
+  unsigned stall_cycles;  // cycles command execution waits for memory
+  unsigned commands;      // executed commands
+};
+
+static inline int display_dma_get_counters(int fd, struct DmaPerfCounters* c) { return ioctl(fd, 0xaae, c); }
+static inline int display_dma_reset_counters(int fd) { return ioctl(fd, 0xaaf, 0); }
+
 #define DISPLAY_CFG_TEXT_ON     1
 #define DISPLAY_CFG_GRAPHIC_ON  2
 #define DISPLAY_CFG_RGB565      0  // default
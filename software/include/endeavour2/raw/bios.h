@@ -38,6 +38,14 @@
 
 #define bios_set_video_mode      API_FN(11, int,             enum VideModeId, const VideoMode*)
 
+// Reads a file from the EXT2/EXT4 fs selected in BIOS in chunks, alternating between buf0 and buf1.
+// chunk_size must be a multiple of 4096; buffers should have space for chunk_size bytes.
+// bios_stream_open(stream, path, buf0, buf1, chunk_size) -> err
+#define bios_stream_open         API_FN(12, int,             struct FileStream*, const char*, void*, void*, unsigned)
+
+// bios_stream_next_chunk(stream, &chunk_ptr) -> chunk size; 0 - end of file; -1 - IO error
+#define bios_stream_next_chunk   API_FN(13, int,             struct FileStream*, void**)
+
 static inline unsigned bios_get_sdcard_sector_count() { return *(unsigned*)(RAM_BASE + 4); }
 
 static inline unsigned bios_get_text_style() { return *(unsigned*)(RAM_BASE + 8); }
@@ -40,4 +40,15 @@ enum VideoModeId {
   VIDEO_MODE_1920x1080_25 = 1921
 };
 
+// Sequential reading of a file in chunks, see bios_stream_open. Chunks are read alternately to buf[0] and buf[1],
+// so the previous chunk stays valid while the next one is being read. Must not be moved after opening.
+struct FileStream {
+  unsigned file_size;
+  unsigned offset;      // bytes already read
+  unsigned chunk_size;
+  void* buf[2];
+  unsigned next_buf;
+  unsigned reader_state[48];  // private
+};
+
 #endif  // ENDEAVOUR2_BIOS_DEFS_H
@@ -69,6 +69,15 @@ struct EndeavourDMA {
   void* cmdAddress;
   unsigned cmdCount;
   unsigned int_stat;
+  void* linkAddress;   // next command list, started when the current one is finished
+  unsigned linkCount;  // read: 1 if the linked list is not started yet
+  // Performance counters (32 bit, wrap around). Writing any value to perfBusyCycles resets all of them.
+  unsigned perfBusyCycles;   // cycles the controller is not idle
+  unsigned perfReadBeats;    // 8-byte TileLink read beats, including command fetch
+  unsigned perfWriteBeats;   // 8-byte TileLink write beats
+  unsigned perfStallCycles;  // cycles command execution waits for memory operations
+  unsigned perfCommands;     // executed commands
+  unsigned crc32;  // read: CRC32 of bytes processed by DMA_CRC32; write: CRC32 of preceding data (0 to start)
 };
 #define DMA_REGS ((volatile struct EndeavourDMA*)(DMA_BASE))
 
@@ -79,16 +88,40 @@ enum DMA_OPCODE {
   DMA_WRITE_SYNC = 3,
   DMA_SET = 4,
   DMA_COPY = 5,
+  DMA_CRC32 = 6,
   DMA_LOADMAP = 7,
   DMA_MAP1R2 = 8,
   DMA_MAP1R4 = 9,
-  DMA_MIXRGB = 32
+  DMA_EXPAND = 10,
+  DMA_EXPAND_TRANSPARENT = 11,
+  DMA_TRANSPOSE = 12,
+  DMA_RECT_READ = 16,
+  DMA_RECT_WRITE = 17,
+  DMA_RECT_READ_SYNC = 18,
+  DMA_RECT_WRITE_SYNC = 19,
+  DMA_RECT_SETUP = 20,
+  DMA_JUMP = 21,
+  DMA_LOOP = 22,
+  DMA_ENDLOOP = 23,
+  DMA_RESAMPLE_SETUP = 24,
+  DMA_EXPAND_SETUP = 25,
+  DMA_MIXRGB = 32,
+  DMA_BLEND = 34,
+  DMA_BLEND_RGAB = 35,
+  DMA_RESAMPLE = 36,
+  DMA_RESAMPLE_LINEAR = 37,
+  DMA_YUV420 = 38
 };
 
 #define DMA_CMD_LO(b_arg2, b_arg1) (((b_arg2)<<13) | (b_arg1))
 #define DMA_CMD_HI(opcode, b_from, b_to) (((opcode)<<26) | ((b_from)<<13) | ((b_to)&0x1fff))
 #define DMA_BUFFER_SIZE (8192 - 128)
 
+// DMA_RECT_* operations process lines of RECT_SETUP line size packed in the buffer range [b_from, b_to).
+// Memory address advances by the source (reads) or destination (writes) stride after every line.
+// Strides are signed, must be multiples of 64, and are limited to +-2MB.
+#define DMA_RECT_STRIDES(src_stride, dst_stride) (((((int)(dst_stride)/64) & 0xffff) << 16) | (((int)(src_stride)/64) & 0xffff))
+
 #endif
 
 // *** SPI Flash
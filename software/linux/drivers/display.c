@@ -6,6 +6,8 @@
 #include <linux/cdev.h>
 #include <linux/mm.h>
 #include <linux/fb.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
 
 // Range 256KB - 32MB
 #define DISPLAY_RESERVED_START (256<<10)
@@ -60,40 +62,106 @@ struct EndeavourDMA {
   unsigned cmdAddress;
   unsigned cmdCount;
   unsigned int_stat;
+  unsigned linkAddress;
+  unsigned linkCount;  // read: 1 if the linked list is not started yet
+  unsigned perfBusyCycles;  // write: reset all performance counters
+  unsigned perfReadBeats;
+  unsigned perfWriteBeats;
+  unsigned perfStallCycles;
+  unsigned perfCommands;
+  unsigned crc32;
 };
 
 static volatile struct EndeavourDMA __iomem * dma_regs;
-static struct mutex dma_lock;
-static struct completion dma_ready;
 static int dma_irq;
 
+// Submitted DMA command batches are queued in a ring. One batch runs in the controller and the next one is
+// linked to it, so the controller continues without going idle; the interrupt handler refills the link.
+// Every batch gets a fence id; batches complete in order, so a fence is reached when all batches up to it
+// are finished.
+#define DMA_RING_SIZE 64
+
+struct DmaBatch {
+  unsigned cmd_addr;
+  unsigned cmd_count;
+};
+
+static struct DmaBatch dma_ring[DMA_RING_SIZE];
+static unsigned dma_ring_head, dma_ring_tail;  // waiting batches are [tail, head), free-running counters
+static u32 dma_last_fence;       // fence of the last submitted batch
+static u32 dma_completed_fence;  // fence of the last finished batch
+static unsigned dma_in_hw;  // 0 - idle, 1 - running, 2 - running and the next batch is linked
+static spinlock_t dma_lock;
+static DECLARE_WAIT_QUEUE_HEAD(dma_wq);
+
+static bool dma_fence_reached(u32 fence) { return (s32)(READ_ONCE(dma_completed_fence) - fence) >= 0; }
+static bool dma_ring_has_space(void) { return READ_ONCE(dma_ring_head) - READ_ONCE(dma_ring_tail) < DMA_RING_SIZE; }
+
+// Should be called with dma_lock held.
+static void dma_start_next(void) {
+  while (dma_in_hw < 2 && dma_ring_tail != dma_ring_head) {
+    struct DmaBatch* b = &dma_ring[dma_ring_tail % DMA_RING_SIZE];
+    WRITE_ONCE(dma_ring_tail, dma_ring_tail + 1);
+    asm volatile("fence i, o");
+    if (dma_in_hw == 0) {
+      dma_regs->cmdAddress = b->cmd_addr;
+      asm volatile("fence ow, o");
+      dma_regs->cmdCount = b->cmd_count;
+    } else {
+      dma_regs->linkAddress = b->cmd_addr;
+      asm volatile("fence ow, o");
+      dma_regs->linkCount = b->cmd_count;
+    }
+    asm volatile("fence o, i");
+    dma_in_hw++;
+  }
+}
+
 static irqreturn_t dma_irq_handler(int irq, void *dev_id) {
+  spin_lock(&dma_lock);
   dma_regs->int_stat = 0;
-  complete(&dma_ready);
+  if (dma_regs->int_stat) {  // idle
+    WRITE_ONCE(dma_completed_fence, dma_completed_fence + dma_in_hw);
+    dma_in_hw = 0;
+  } else if (dma_in_hw == 2 && !dma_regs->linkCount) {  // linked batch started, so the previous one is finished
+    WRITE_ONCE(dma_completed_fence, dma_completed_fence + 1);
+    dma_in_hw = 1;
+  }
+  dma_start_next();
+  if (dma_in_hw) dma_regs->int_stat = 1;  // interrupt when idle or when the linked batch is started
+  spin_unlock(&dma_lock);
+  wake_up_all(&dma_wq);
   return IRQ_HANDLED;
 }
 
-static void wait_dma_ready(void) {
-  while (!dma_regs->int_stat) {
-    reinit_completion(&dma_ready);
-    dma_regs->int_stat = 1;
-    wait_for_completion(&dma_ready);
+// Returns the fence of the batch. Blocks only if the ring is full (unless O_NONBLOCK).
+static int dma_submit(struct file *filp, unsigned cmd_addr, unsigned cmd_count, u32* fence) {
+  unsigned long flags;
+  while (1) {
+    spin_lock_irqsave(&dma_lock, flags);
+    if (dma_ring_head - dma_ring_tail < DMA_RING_SIZE) break;
+    spin_unlock_irqrestore(&dma_lock, flags);
+    if (filp->f_flags & O_NONBLOCK) return -EAGAIN;
+    if (wait_event_interruptible(dma_wq, dma_ring_has_space())) return -ERESTARTSYS;
   }
-}
-
-static int call_dma(unsigned cmd_addr, unsigned cmd_count, unsigned sync) {
-  if (mutex_lock_interruptible(&dma_lock))
-    return -ERESTARTSYS;
-  wait_dma_ready();
   if (cmd_count > 0) {
-    asm volatile("fence i, o");
-    dma_regs->cmdAddress = cmd_addr;
-    asm volatile("fence ow, o");
-    dma_regs->cmdCount = cmd_count;
-    asm volatile("fence o, i");
-    if (sync) wait_dma_ready();
+    dma_ring[dma_ring_head % DMA_RING_SIZE] = (struct DmaBatch){cmd_addr, cmd_count};
+    WRITE_ONCE(dma_ring_head, dma_ring_head + 1);
+    dma_last_fence++;
+    if (dma_in_hw < 2) {
+      dma_start_next();
+      dma_regs->int_stat = 1;
+    }
   }
-  mutex_unlock(&dma_lock);
+  *fence = dma_last_fence;
+  filp->private_data = (void*)(uintptr_t)dma_last_fence;  // used by poll
+  spin_unlock_irqrestore(&dma_lock, flags);
+  return 0;
+}
+
+static int dma_wait_fence(u32 fence) {
+  if ((s32)(fence - READ_ONCE(dma_last_fence)) > 0) return -EINVAL;  // not submitted yet
+  if (wait_event_interruptible(dma_wq, dma_fence_reached(fence))) return -ERESTARTSYS;
   return 0;
 }
 
@@ -116,7 +184,11 @@ static long display_ioctl(struct file *filp, unsigned int cmd, unsigned long arg
     struct EndeavourVideoMode vm;
     struct { unsigned x, y; } size;
     struct { unsigned cmd_addr, cmd_count, sync; } dma_request;
+    struct { unsigned cmd_addr, cmd_count, fence; } dma_submit;
+    struct { unsigned busy_cycles, read_beats, write_beats, stall_cycles, commands; } dma_perf;
   } p;
+  int ret;
+  u32 fence;
   switch (cmd) {
     case 0xaa0: // get text addr
       p.ta.buffer_addr = display_regs->textAddr & (DISPLAY_RESERVED_END - 1);
@@ -170,9 +242,32 @@ static long display_ioctl(struct file *filp, unsigned int cmd, unsigned long arg
       set_pixel_freq(p.vm.clock);
       display_regs->mode = p.vm;
       break;
-    case 0xaab: // dma
+    case 0xaab: // dma; returns when all earlier batches (or, if sync, also this one) are finished
       if (copy_from_user(&p.dma_request, (void*)arg, sizeof(p.dma_request))) return -1;
-      return call_dma(p.dma_request.cmd_addr, p.dma_request.cmd_count, p.dma_request.sync);
+      ret = dma_submit(filp, p.dma_request.cmd_addr, p.dma_request.cmd_count, &fence);
+      if (ret) return ret;
+      // Callers reuse command memory of the previous batch once this returns, so it must be finished.
+      if (!p.dma_request.sync && p.dma_request.cmd_count > 0) fence--;
+      return dma_wait_fence(fence);
+    case 0xaac: // dma, async
+      if (copy_from_user(&p.dma_submit, (void*)arg, sizeof(p.dma_submit))) return -1;
+      ret = dma_submit(filp, p.dma_submit.cmd_addr, p.dma_submit.cmd_count, &fence);
+      if (ret) return ret;
+      p.dma_submit.fence = fence;
+      if (copy_to_user((void*)arg, &p.dma_submit, sizeof(p.dma_submit))) return -1;
+      break;
+    case 0xaad: // wait dma fence
+      return dma_wait_fence(arg);
+    case 0xaae: // get dma performance counters
+      p.dma_perf.busy_cycles = dma_regs->perfBusyCycles;
+      p.dma_perf.read_beats = dma_regs->perfReadBeats;
+      p.dma_perf.write_beats = dma_regs->perfWriteBeats;
+      p.dma_perf.stall_cycles = dma_regs->perfStallCycles;
+      p.dma_perf.commands = dma_regs->perfCommands;
+      if (copy_to_user((void*)arg, &p.dma_perf, sizeof(p.dma_perf))) return -1;
+      break;
+    case 0xaaf: // reset dma performance counters
+      dma_regs->perfBusyCycles = 0;
       break;
     default:
       return -1;
@@ -189,10 +284,20 @@ static int display_mmap(struct file *filp, struct vm_area_struct *vma) {
   return remap_pfn_range(vma, vma->vm_start, (0x80000000 >> PAGE_SHIFT) + vma->vm_pgoff, len, vma->vm_page_prot);
 }
 
+// EPOLLIN - all DMA batches submitted through this file are finished; EPOLLOUT - DMA submission won't block.
+static __poll_t display_poll(struct file *filp, poll_table *wait) {
+  __poll_t mask = 0;
+  poll_wait(filp, &dma_wq, wait);
+  if (dma_fence_reached((u32)(uintptr_t)filp->private_data)) mask |= EPOLLIN | EPOLLRDNORM;
+  if (dma_ring_has_space()) mask |= EPOLLOUT | EPOLLWRNORM;
+  return mask;
+}
+
 static const struct file_operations display_ops = {
     .owner = THIS_MODULE,
     .unlocked_ioctl = display_ioctl,
-    .mmap = display_mmap
+    .mmap = display_mmap,
+    .poll = display_poll
 };
 
 static struct fb_info* fbinfo;
@@ -314,8 +419,7 @@ static int display_probe(struct platform_device *pdev) {
   dma_regs = devm_platform_get_and_ioremap_resource(pdev, 1, NULL);
   if (IS_ERR((void*)dma_regs))
     return PTR_ERR((void*)dma_regs);
-  mutex_init(&dma_lock);
-  init_completion(&dma_ready);
+  spin_lock_init(&dma_lock);
   dma_irq = platform_get_irq(pdev, 0);
   if (dma_irq < 0) {
     dev_err(&pdev->dev, "Can't get dma irq\n");
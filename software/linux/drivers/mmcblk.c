@@ -1,13 +1,31 @@
 #include <linux/platform_device.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/fs.h>
 #include <linux/of.h>
+#include <linux/interrupt.h>
+#include <linux/workqueue.h>
+#include <linux/delay.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
 
 static spinlock_t mmc_lk;
 static void __iomem * mmc_membase;
 static unsigned mmc_sector_count;
 static unsigned mmc_rca;
 
+// Requests are queued by mmcblk_queue_rq and processed one by one by mmc_work.
+// The controller interrupt is a pulse at the end of every command / data block.
+static struct blk_mq_tag_set mmc_tag_set;
+static LIST_HEAD(mmc_queue);
+static struct workqueue_struct *mmc_wq;
+static struct work_struct mmc_work;
+static struct completion mmc_irq_done;
+static int mmc_irq;
+
+#define MMC_SPIN_COUNT 256  // polls before sleeping; a data block at 50 MB/s takes ~10us
+
 #define SDCARD_CMD 0x0
 #define SDCARD_DATA 0x4
 #define SDCARD_FIFO0 0x8
@@ -53,28 +71,165 @@ static const unsigned
     SDIO_ERR      = 0x00008000,
     SDIO_BUSY     = 0x00104800;
 
+// *** Statistics, see /sys/kernel/debug/mmcblk/stats. Updated only by the worker.
+
+enum { MMC_STAT_READ, MMC_STAT_WRITE, MMC_STAT_DISCARD, MMC_STAT_OPS };
+enum { MMC_PHASE_ISSUE, MMC_PHASE_TRANSFER, MMC_PHASE_BUSY, MMC_PHASES };
+#define MMC_HIST_BUCKETS 20  // bucket 0: < 1us; bucket i: [2^(i-1), 2^i) us; the last one also includes all above
+
+static const char* const mmc_stat_op_names[MMC_STAT_OPS] = {"read", "write", "discard"};
+static const char* const mmc_phase_names[MMC_PHASES] = {"issue", "transfer", "busy"};
+
+struct mmc_stats {
+  u64 commands, sectors, errors;
+  u64 time_ns[MMC_PHASES];
+  u64 hist[MMC_PHASES][MMC_HIST_BUCKETS];
+};
+
+static struct mmc_stats mmc_stats[MMC_STAT_OPS];
+static int mmc_stat_op;      // operation of the current request
+static u64 mmc_data_start;   // end of the issue phase of the current transfer
+
+// Accounts time since `start` to the given phase and returns the current time.
+static u64 account_phase(int phase, u64 start) {
+  u64 now = ktime_get_ns();
+  u64 us = div_u64(now - start, 1000);
+  int bucket = min(fls64(us), MMC_HIST_BUCKETS - 1);
+  mmc_stats[mmc_stat_op].time_ns[phase] += now - start;
+  mmc_stats[mmc_stat_op].hist[phase][bucket]++;
+  return now;
+}
+
+static int mmcblk_stats_show(struct seq_file *m, void *v) {
+  seq_printf(m, "%-16s", "");
+  for (int op = 0; op < MMC_STAT_OPS; ++op) seq_printf(m, " %12s", mmc_stat_op_names[op]);
+  seq_printf(m, "\n%-16s", "commands");
+  for (int op = 0; op < MMC_STAT_OPS; ++op) seq_printf(m, " %12llu", mmc_stats[op].commands);
+  seq_printf(m, "\n%-16s", "sectors");
+  for (int op = 0; op < MMC_STAT_OPS; ++op) seq_printf(m, " %12llu", mmc_stats[op].sectors);
+  seq_printf(m, "\n%-16s", "errors");
+  for (int op = 0; op < MMC_STAT_OPS; ++op) seq_printf(m, " %12llu", mmc_stats[op].errors);
+  for (int phase = 0; phase < MMC_PHASES; ++phase) {
+    seq_printf(m, "\n%-8s time us", mmc_phase_names[phase]);
+    for (int op = 0; op < MMC_STAT_OPS; ++op) seq_printf(m, " %12llu", div_u64(mmc_stats[op].time_ns[phase], 1000));
+  }
+  seq_printf(m, "\n");
+  for (int phase = 0; phase < MMC_PHASES; ++phase) {
+    seq_printf(m, "\n%s latency", mmc_phase_names[phase]);
+    for (int b = 0; b < MMC_HIST_BUCKETS; ++b) {
+      if (b == 0)
+        seq_printf(m, "\n%-16s", "< 1us");
+      else
+        seq_printf(m, "\n%s %9uus  ", b == MMC_HIST_BUCKETS - 1 ? ">=" : "< ", 1u << (b - (b == MMC_HIST_BUCKETS - 1)));
+      for (int op = 0; op < MMC_STAT_OPS; ++op) seq_printf(m, " %12llu", mmc_stats[op].hist[phase][b]);
+    }
+    seq_printf(m, "\n");
+  }
+  return 0;
+}
+
+static int mmcblk_stats_open(struct inode *inode, struct file *file) {
+  return single_open(file, mmcblk_stats_show, NULL);
+}
+
+// any write resets the statistics
+static ssize_t mmcblk_stats_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos) {
+  memset(mmc_stats, 0, sizeof(mmc_stats));
+  return count;
+}
+
+static const struct file_operations mmcblk_stats_fops = {
+  .owner = THIS_MODULE,
+  .open = mmcblk_stats_open,
+  .read = seq_read,
+  .write = mmcblk_stats_write,
+  .llseek = seq_lseek,
+  .release = single_release,
+};
+
+static irqreturn_t mmcblk_irq_handler(int irq, void *dev_id) {
+  complete(&mmc_irq_done);
+  return IRQ_HANDLED;
+}
+
+// Polls for a short time, then sleeps until the controller interrupt. The timeout covers a missed pulse.
+static void wait_not_busy(void) {
+  for (int i = 0; i < MMC_SPIN_COUNT; ++i) {
+    if (!(ioread32(mmc_membase + SDCARD_CMD) & SDIO_BUSY)) return;
+  }
+  while (1) {
+    reinit_completion(&mmc_irq_done);
+    if (!(ioread32(mmc_membase + SDCARD_CMD) & SDIO_BUSY)) return;
+    wait_for_completion_timeout(&mmc_irq_done, msecs_to_jiffies(10));
+  }
+}
+
 static void command(unsigned cmd, unsigned arg) {
   iowrite32(arg, mmc_membase + SDCARD_DATA);
   iowrite32(SDIO_CMD | SDIO_ERR | cmd, mmc_membase + SDCARD_CMD);
-  while (ioread32(mmc_membase + SDCARD_CMD) & SDIO_BUSY);
+  wait_not_busy();
 }
 
 static void sd_wait_ready(void) {
   int counter = 0;
+  u64 start = ktime_get_ns();
   while (1) {
     command(SDIO_R1 | 13, mmc_rca);
-    if (ioread32(mmc_membase + SDCARD_DATA) & (1<<8)) return;
-    if (++counter > 10000000) {
+    if (ioread32(mmc_membase + SDCARD_DATA) & (1<<8)) break;
+    if (++counter > 100000) {  // ~10 s
       printk("mmcblk timeout\n");
-      return;
+      break;
     }
+    usleep_range(50, 100);  // the card is busy (e.g. programming written blocks)
+  }
+  account_phase(MMC_PHASE_BUSY, start);
+}
+
+// Consecutive sectors of a request are transferred with a single CMD18/CMD25; sectors are
+// distributed over the segment buffers.
+struct mmc_segment {
+  unsigned* ptr;
+  unsigned sector_count;
+};
+
+#define MMC_MAJOR 101
+#define MMC_MAX_SEGMENTS 128
+#define MMC_MAX_HW_SECTORS 2048  // 1 MB
+#define MMC_MAX_DISCARD_SECTORS (64<<11)  // 64 MB, limits the time the card stays busy with a single erase
+static struct mmc_segment mmc_segs[MMC_MAX_SEGMENTS];
+
+struct sector_cursor {
+  const struct mmc_segment* seg;
+  unsigned* ptr;
+  unsigned left;  // sectors left in the current segment
+};
+
+static void cursor_init(struct sector_cursor* c, const struct mmc_segment* segs) {
+  c->seg = segs;
+  c->ptr = segs->ptr;
+  c->left = segs->sector_count;
+}
+
+static unsigned* cursor_next(struct sector_cursor* c) {
+  if (c->left == 0) {
+    c->seg++;
+    c->ptr = c->seg->ptr;
+    c->left = c->seg->sector_count;
   }
+  unsigned* ptr = c->ptr;
+  c->ptr += 128;
+  c->left--;
+  return ptr;
 }
 
-static unsigned sdread(unsigned* dst, unsigned sector, unsigned sector_count) {
+static unsigned sdread(const struct mmc_segment* segs, unsigned sector, unsigned sector_count) {
+  struct sector_cursor dst;
   if (sector_count == 0) return 0;
+  cursor_init(&dst, segs);
   sd_wait_ready();
+  u64 start = ktime_get_ns();
   command(SDIO_R1 | SDIO_MEM | 18, sector);
+  mmc_data_start = account_phase(MMC_PHASE_ISSUE, start);
   unsigned fifo = SDIO_FIFO;
   for (unsigned b = 0; b < sector_count - 1; ++b) {
     if (ioread32(mmc_membase + SDCARD_CMD) & SDIO_ERR) {
@@ -82,73 +237,150 @@ static unsigned sdread(unsigned* dst, unsigned sector, unsigned sector_count) {
       return b;
     }
     iowrite32(SDIO_MEM | fifo, mmc_membase + SDCARD_CMD);
-    dst = receive_sector(dst, fifo ? SDCARD_FIFO0_LE : SDCARD_FIFO1_LE);
+    receive_sector(cursor_next(&dst), fifo ? SDCARD_FIFO0_LE : SDCARD_FIFO1_LE);
     fifo ^= SDIO_FIFO;
-    while (ioread32(mmc_membase + SDCARD_CMD) & SDIO_BUSY);
+    wait_not_busy();
+    cond_resched();
   }
   int err = ioread32(mmc_membase + SDCARD_CMD) & SDIO_ERR;
   command(SDIO_R1b | 12, 0);
   if (err) return sector_count - 1;
-  receive_sector(dst, fifo ? SDCARD_FIFO0_LE : SDCARD_FIFO1_LE);
+  receive_sector(cursor_next(&dst), fifo ? SDCARD_FIFO0_LE : SDCARD_FIFO1_LE);
   return sector_count;
 }
 
-static unsigned sdwrite(const unsigned* src, unsigned sector, unsigned sector_count) {
+static unsigned sdwrite(const struct mmc_segment* segs, unsigned sector, unsigned sector_count) {
+  struct sector_cursor src;
   if (sector_count == 0) return 0;
+  cursor_init(&src, segs);
   sd_wait_ready();
-  src = send_sector(src, SDCARD_FIFO0_LE);
+  u64 start = ktime_get_ns();
+  if (sector_count > 1) {
+    // ACMD23 - number of blocks to pre-erase before the multiple block write
+    command(SDIO_R1 | 55, mmc_rca);
+    command(SDIO_R1 | 23, sector_count);
+  }
+  send_sector(cursor_next(&src), SDCARD_FIFO0_LE);
   iowrite32(sector, mmc_membase + SDCARD_DATA);
   iowrite32(SDIO_CMD | SDIO_ERR | SDIO_R1 | SDIO_WRITE | SDIO_ACK | SDIO_MEM | 25, mmc_membase + SDCARD_CMD);
+  mmc_data_start = account_phase(MMC_PHASE_ISSUE, start);
   unsigned fifo = 0;
   for (unsigned b = 0; b < sector_count - 1; ++b) {
     fifo ^= SDIO_FIFO;
-    src = send_sector(src, fifo ? SDCARD_FIFO1_LE : SDCARD_FIFO0_LE);
-    while (ioread32(mmc_membase + SDCARD_CMD) & SDIO_BUSY);
+    send_sector(cursor_next(&src), fifo ? SDCARD_FIFO1_LE : SDCARD_FIFO0_LE);
+    wait_not_busy();
+    cond_resched();
     if (ioread32(mmc_membase + SDCARD_CMD) & SDIO_ERR) {
       command(SDIO_R1b | 12, 0);
       return b;
     }
     iowrite32(SDIO_WRITE | SDIO_MEM | fifo, mmc_membase + SDCARD_CMD);
   }
-  while (ioread32(mmc_membase + SDCARD_CMD) & SDIO_BUSY);
+  wait_not_busy();
   int err = ioread32(mmc_membase + SDCARD_CMD) & SDIO_ERR;
   command(SDIO_R1b | 12, 0);
   return err ? sector_count - 1 : sector_count;
 }
 
-static bool process_segment(void* ptr, unsigned sector, unsigned sector_count, bool write) {
+// CMD32/CMD33 - first/last sector to erase, CMD38 - erase
+static bool sderase(unsigned sector, unsigned sector_count) {
+  bool ok = false;
+  sd_wait_ready();
+  u64 start = ktime_get_ns();
+  command(SDIO_R1 | 32, sector);
+  if (ioread32(mmc_membase + SDCARD_CMD) & SDIO_ERR) goto end;
+  command(SDIO_R1 | 33, sector + sector_count - 1);
+  if (ioread32(mmc_membase + SDCARD_CMD) & SDIO_ERR) goto end;
+  command(SDIO_R1b | 38, 0);
+  ok = !(ioread32(mmc_membase + SDCARD_CMD) & SDIO_ERR);
+end:
+  account_phase(MMC_PHASE_ISSUE, start);
+  if (ok) sd_wait_ready();  // erase can keep the card busy for a long time
+  mmc_stats[MMC_STAT_DISCARD].commands++;
+  if (ok) mmc_stats[MMC_STAT_DISCARD].sectors += sector_count;
+  else mmc_stats[MMC_STAT_DISCARD].errors++;
+  return ok;
+}
+
+static bool transfer(unsigned seg_count, unsigned sector, unsigned sector_count, bool write) {
+  if (seg_count == 0) return true;
+  unsigned done;
   if (write)
-    return sdwrite((unsigned*)ptr, sector, sector_count) == sector_count;
+    done = sdwrite(mmc_segs, sector, sector_count);
   else
-    return sdread((unsigned*)ptr, sector, sector_count) == sector_count;
+    done = sdread(mmc_segs, sector, sector_count);
+  account_phase(MMC_PHASE_TRANSFER, mmc_data_start);
+  struct mmc_stats* st = &mmc_stats[mmc_stat_op];
+  st->commands++;
+  st->sectors += done;
+  if (done != sector_count) st->errors++;
+  return done == sector_count;
 }
 
-static void mmcblk_submit_bio(struct bio *bio) {
+static blk_status_t mmcblk_process_request(struct request *rq) {
+  struct req_iterator iter;
   struct bio_vec bvec;
-  struct bvec_iter iter;
-  if (bio_op(bio) != REQ_OP_READ && bio_op(bio) != REQ_OP_WRITE) {
-    printk("mmcblk unsupported op %d\n", bio_op(bio));
-  }
-  bool write = bio_data_dir(bio) == WRITE;
+  bool write = rq_data_dir(rq) == WRITE;
+  unsigned sector = blk_rq_pos(rq);
+  unsigned seg_count = 0, sector_count = 0;
 
-  bio_for_each_segment(bvec, bio, iter) {
+  mmc_stat_op = req_op(rq) == REQ_OP_DISCARD ? MMC_STAT_DISCARD : write ? MMC_STAT_WRITE : MMC_STAT_READ;
+  if (req_op(rq) == REQ_OP_DISCARD) {
+    sector_count = blk_rq_sectors(rq);
+    if (!sderase(sector, sector_count)) goto error;
+    return BLK_STS_OK;
+  }
+  rq_for_each_segment(bvec, rq, iter) {
     char *ptr = bvec_virt(&bvec);
     if ((unsigned)ptr & 3) printk("mmcblk: wrong buffer alignment\n");
-    unsigned sector = iter.bi_sector;
-    unsigned sector_count = bvec.bv_len >> 9;
-    if (!process_segment(ptr, sector, sector_count, write)) {
-      printk("mmcblk error write=%d  ptr=0x%x  sector=%d  count=%d\n", (int)write, (unsigned)ptr, sector, sector_count);
-      bio_io_error(bio);
-      return;
+    if (seg_count == MMC_MAX_SEGMENTS) {  // single-page segments of a request can exceed max_segments
+      if (!transfer(seg_count, sector, sector_count, write)) goto error;
+      sector += sector_count;
+      seg_count = sector_count = 0;
     }
+    mmc_segs[seg_count].ptr = (unsigned*)ptr;
+    mmc_segs[seg_count].sector_count = bvec.bv_len >> 9;
+    sector_count += bvec.bv_len >> 9;
+    seg_count++;
   }
+  if (!transfer(seg_count, sector, sector_count, write)) goto error;
+  return BLK_STS_OK;
+error:
+  printk("mmcblk error op=%d  sector=%d  count=%d\n", req_op(rq), sector, sector_count);
+  return BLK_STS_IOERR;
+}
 
-  bio_endio(bio);
+static void mmcblk_work(struct work_struct *work) {
+  while (1) {
+    spin_lock_irq(&mmc_lk);
+    struct request *rq = list_first_entry_or_null(&mmc_queue, struct request, queuelist);
+    if (rq) list_del_init(&rq->queuelist);
+    spin_unlock_irq(&mmc_lk);
+    if (!rq) return;
+    blk_mq_end_request(rq, mmcblk_process_request(rq));
+  }
 }
 
+static blk_status_t mmcblk_queue_rq(struct blk_mq_hw_ctx *hctx, const struct blk_mq_queue_data *bd) {
+  struct request *rq = bd->rq;
+  if (req_op(rq) != REQ_OP_READ && req_op(rq) != REQ_OP_WRITE && req_op(rq) != REQ_OP_DISCARD) {
+    printk("mmcblk unsupported op %d\n", req_op(rq));
+    return BLK_STS_NOTSUPP;
+  }
+  blk_mq_start_request(rq);
+  spin_lock_irq(&mmc_lk);
+  list_add_tail(&rq->queuelist, &mmc_queue);
+  spin_unlock_irq(&mmc_lk);
+  queue_work(mmc_wq, &mmc_work);
+  return BLK_STS_OK;
+}
+
+static const struct blk_mq_ops mmcblk_mq_ops = {
+  .queue_rq = mmcblk_queue_rq,
+};
+
 static struct block_device_operations mmcblk_ops = {
   .owner = THIS_MODULE,
-  .submit_bio = mmcblk_submit_bio
 };
 
 static unsigned sbi_get_val(int arg) {
@@ -167,14 +399,55 @@ static int mmcblk_probe(struct platform_device *dev)
     return PTR_ERR(mmc_membase);
   mmc_sector_count = sbi_get_val(1);
   mmc_rca = sbi_get_val(2);
-  printk("mmcblk  reg 0x%x  rca 0x%04x  size %u MB\n", (unsigned)dev->resource[0].start, mmc_rca >> 16, mmc_sector_count >> 11);
+  unsigned bus_mode = sbi_get_val(6);  // bus clock in MHz | sample shift << 16; chosen by BIOS
+  printk("mmcblk  reg 0x%x  rca 0x%04x  size %u MB  bus %u MHz  sample shift %u\n", (unsigned)dev->resource[0].start,
+         mmc_rca >> 16, mmc_sector_count >> 11, bus_mode & 0xffff, (bus_mode >> 16) & 0x1f);
 
-  int major_number = register_blkdev(101, "mmcblk");
+  spin_lock_init(&mmc_lk);
+  init_completion(&mmc_irq_done);
+  INIT_WORK(&mmc_work, mmcblk_work);
+
+  mmc_irq = platform_get_irq(dev, 0);
+  if (mmc_irq < 0) {
+    dev_err(&dev->dev, "Can't get mmcblk irq\n");
+    return mmc_irq;
+  }
 
-  struct gendisk *mmc = blk_alloc_disk(NULL, NUMA_NO_NODE);
-  if (!mmc) return -ENOMEM;
+  mmc_wq = alloc_workqueue("mmcblk", WQ_MEM_RECLAIM, 1);
+  if (!mmc_wq) return -ENOMEM;
 
-  spin_lock_init(&mmc_lk);
+  int err = request_irq(mmc_irq, mmcblk_irq_handler, IRQF_TRIGGER_HIGH, "mmcblk_irq", dev);
+  if (err) {
+    dev_err(&dev->dev, "Failed to request IRQ %d\n", mmc_irq);
+    goto err_wq;
+  }
+
+  int major_number = register_blkdev(MMC_MAJOR, "mmcblk");
+  if (major_number < 0) {
+    err = major_number;
+    goto err_irq;
+  }
+
+  mmc_tag_set.ops = &mmcblk_mq_ops;
+  mmc_tag_set.nr_hw_queues = 1;
+  mmc_tag_set.queue_depth = 16;
+  mmc_tag_set.numa_node = NUMA_NO_NODE;
+  mmc_tag_set.flags = BLK_MQ_F_SHOULD_MERGE;
+  err = blk_mq_alloc_tag_set(&mmc_tag_set);
+  if (err) goto err_blkdev;
+
+  struct queue_limits lim = {
+    .logical_block_size = 512,
+    .max_hw_sectors = MMC_MAX_HW_SECTORS,
+    .max_segments = MMC_MAX_SEGMENTS,
+    .discard_granularity = 512,  // SD erase works on write blocks
+    .max_hw_discard_sectors = MMC_MAX_DISCARD_SECTORS,
+  };
+  struct gendisk *mmc = blk_mq_alloc_disk(&mmc_tag_set, &lim, NULL);
+  if (IS_ERR(mmc)) {
+    err = PTR_ERR(mmc);
+    goto err_tag_set;
+  }
 
   snprintf(mmc->disk_name, 8, "mmcblk0");  // /dev/mmcblk0
 
@@ -185,7 +458,25 @@ static int mmcblk_probe(struct platform_device *dev)
 
   set_capacity(mmc, mmc_sector_count);
 
-  return add_disk(mmc);
+  struct dentry *debug_dir = debugfs_create_dir("mmcblk", NULL);
+  debugfs_create_file("stats", 0644, debug_dir, NULL, &mmcblk_stats_fops);
+
+  err = add_disk(mmc);
+  if (err) goto err_disk;
+  return 0;
+
+err_disk:
+  debugfs_remove(debug_dir);
+  put_disk(mmc);
+err_tag_set:
+  blk_mq_free_tag_set(&mmc_tag_set);
+err_blkdev:
+  unregister_blkdev(MMC_MAJOR, "mmcblk");
+err_irq:
+  free_irq(mmc_irq, dev);
+err_wq:
+  destroy_workqueue(mmc_wq);
+  return err;
 }
 
 static const struct of_device_id mmcblk_match[] = {